@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <string>
 #include <cstring>
+#include <cmath>
+#include <stdint.h>
 
 #include <glm/glm.hpp>
 
@@ -111,6 +113,258 @@ bool loadOBJ(
 }
 
 
+// Reads the whole file at once, followed by a '\0' so that scanning the
+// buffer stops at its end
+static bool readWholeFile(const char * path, std::vector<char> & buffer){
+	FILE * file = fopen(path, "rb");
+	if( file == NULL ){
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if( size < 0 ){
+		fclose(file);
+		return false;
+	}
+	buffer.resize((size_t)size + 1);
+	size_t read = fread(buffer.data(), 1, (size_t)size, file);
+	fclose(file);
+	buffer.resize(read + 1);
+	buffer[read] = '\0';
+	return true;
+}
+
+static inline bool isDigit(char c){
+	return c >= '0' && c <= '9';
+}
+
+static inline void skipSpaces(const char *& p){
+	while( *p == ' ' || *p == '\t' ) p++;
+}
+
+static inline bool isLineEnd(char c){
+	return c == '\n' || c == '\r' || c == '\0';
+}
+
+static inline void skipLine(const char *& p){
+	while( *p != '\n' && *p != '\0' ) p++;
+	if( *p == '\n' ) p++;
+}
+
+// Parses a decimal float in place, like strtof without the locale. The
+// first 19 significant digits are kept, which is exact for the short
+// numbers exporters write
+static float parseFloat(const char *& p){
+	static const double powers[] = {
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	skipSpaces(p);
+	bool negative = *p == '-';
+	if( *p == '-' || *p == '+' ) p++;
+
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	for( ; isDigit(*p); p++ ){
+		if( digits < 19 ){
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += mantissa != 0;
+		}else{
+			exponent++;
+		}
+	}
+	if( *p == '.' ){
+		for( p++; isDigit(*p); p++ ){
+			if( digits < 19 ){
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+	if( *p == 'e' || *p == 'E' ){
+		const char * e = p + 1;
+		bool negativeExponent = *e == '-';
+		if( *e == '-' || *e == '+' ) e++;
+		if( isDigit(*e) ){
+			int value = 0;
+			for( ; isDigit(*e); e++ ){
+				if( value < 10000 ) value = value * 10 + (*e - '0');
+			}
+			exponent += negativeExponent ? -value : value;
+			p = e;
+		}
+	}
+
+	double value = (double)mantissa;
+	if( exponent < 0 ){
+		value = -exponent <= 22 ? value / powers[-exponent] : value * pow(10.0, exponent);
+	}else if( exponent > 0 ){
+		value = exponent <= 22 ? value * powers[exponent] : value * pow(10.0, exponent);
+	}
+	return (float)(negative ? -value : value);
+}
+
+// Parses a 1-based or negative (relative) OBJ index into the count elements
+// read so far, returns it 0-based, -1 when there is none or -2 when it is
+// out of range
+static int parseIndex(const char *& p, size_t count){
+	bool negative = *p == '-';
+	if( negative ) p++;
+	if( !isDigit(*p) ){
+		return negative ? -2 : -1;
+	}
+	long value = 0;
+	for( ; isDigit(*p); p++ ){
+		if( value < 0x7FFFFFFF ) value = value * 10 + (*p - '0');
+	}
+	long index = negative ? (long)count - value : value - 1;
+	return index >= 0 && index < (long)count ? (int)index : -2;
+}
+
+// Output vertex of each distinct position/uv/normal index triple, with
+// linear probing in a table kept at most half full
+class CornerTable {
+public:
+	CornerTable() : slots(1024), count(0) {}
+
+	// Returns the output index stored for the triple, or claims a slot for
+	// it that the caller fills
+	unsigned int & find(int v, int vt, int vn, bool & found){
+		if( 2 * (count + 1) > slots.size() ) grow();
+		Slot & slot = probe(v, vt, vn);
+		found = slot.v >= 0;
+		if( !found ){
+			slot.v = v;
+			slot.vt = vt;
+			slot.vn = vn;
+			count++;
+		}
+		return slot.value;
+	}
+
+private:
+	struct Slot {
+		int v, vt, vn;   // v is -1 for an empty slot
+		unsigned int value;
+		Slot() : v(-1), vt(-1), vn(-1), value(0) {}
+	};
+
+	Slot & probe(int v, int vt, int vn){
+		uint64_t hash = ((uint64_t)(uint32_t)v * 0x9E3779B97F4A7C15ull) ^
+			((((uint64_t)(uint32_t)vn << 32) | (uint32_t)vt) * 0xC2B2AE3D27D4EB4Full);
+		size_t mask = slots.size() - 1;
+		for( size_t i = (size_t)(hash ^ (hash >> 29)) & mask; ; i = (i + 1) & mask ){
+			Slot & slot = slots[i];
+			if( slot.v < 0 || (slot.v == v && slot.vt == vt && slot.vn == vn) ) return slot;
+		}
+	}
+
+	void grow(){
+		std::vector<Slot> old(slots.size() * 2);
+		old.swap(slots);
+		for( size_t i = 0; i < old.size(); i++ ){
+			if( old[i].v >= 0 ) probe(old[i].v, old[i].vt, old[i].vn) = old[i];
+		}
+	}
+
+	std::vector<Slot> slots;
+	size_t count;
+};
+
+// Same input as loadOBJ, but the file is read at once and tokenized in
+// place, and the output is indexed: one vertex per distinct
+// position/uv/normal combination and 3 indices per triangle. Faces may be
+// polygons (split into fans) and may leave out uvs or normals, which are
+// then zero.
+bool loadOBJIndexed(
+	const char * path, 
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	std::vector<char> buffer;
+	if( !readWholeFile(path, buffer) ){
+		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
+		return false;
+	}
+
+	std::vector<glm::vec3> temp_vertices; 
+	std::vector<glm::vec2> temp_uvs;
+	std::vector<glm::vec3> temp_normals;
+	CornerTable corners;
+	// Output vertices of the corners of the current face
+	std::vector<unsigned int> face;
+
+	for( const char * p = buffer.data(); *p != '\0'; skipLine(p) ){
+		skipSpaces(p);
+
+		if( p[0] == 'v' && (p[1] == ' ' || p[1] == '\t') ){
+			p += 1;
+			glm::vec3 vertex;
+			vertex.x = parseFloat(p);
+			vertex.y = parseFloat(p);
+			vertex.z = parseFloat(p);
+			temp_vertices.push_back(vertex);
+		}else if ( p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t') ){
+			p += 2;
+			glm::vec2 uv;
+			uv.x = parseFloat(p);
+			uv.y = -parseFloat(p); // Inverted like loadOBJ does, for DDS textures.
+			temp_uvs.push_back(uv);
+		}else if ( p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t') ){
+			p += 2;
+			glm::vec3 normal;
+			normal.x = parseFloat(p);
+			normal.y = parseFloat(p);
+			normal.z = parseFloat(p);
+			temp_normals.push_back(normal);
+		}else if ( p[0] == 'f' && (p[1] == ' ' || p[1] == '\t') ){
+			p += 1;
+			face.clear();
+			for( skipSpaces(p); !isLineEnd(*p); skipSpaces(p) ){
+				// v, v/vt, v//vn or v/vt/vn
+				int v = parseIndex(p, temp_vertices.size());
+				int vt = -1, vn = -1;
+				if( *p == '/' ){
+					p++;
+					vt = parseIndex(p, temp_uvs.size());
+					if( *p == '/' ){
+						p++;
+						vn = parseIndex(p, temp_normals.size());
+					}
+				}
+				// Only vt and vn may be left out, nothing may be out of range
+				if( v < 0 || vt < -1 || vn < -1 ||
+					(*p != ' ' && *p != '\t' && !isLineEnd(*p)) ){
+					printf("File can't be read by our simple parser :-( Try exporting with other options\n");
+					return false;
+				}
+
+				bool found;
+				unsigned int & index = corners.find(v, vt, vn, found);
+				if( !found ){
+					index = (unsigned int)out_vertices.size();
+					out_vertices.push_back(temp_vertices[v]);
+					out_uvs     .push_back(vt >= 0 ? temp_uvs[vt] : glm::vec2(0.0f));
+					out_normals .push_back(vn >= 0 ? temp_normals[vn] : glm::vec3(0.0f));
+				}
+				face.push_back(index);
+			}
+			for( size_t k = 2; k < face.size(); k++ ){
+				out_indices.push_back(face[0]);
+				out_indices.push_back(face[k - 1]);
+				out_indices.push_back(face[k]);
+			}
+		}
+		// Anything else is a comment or unsupported, skipLine eats it up
+	}
+
+	return true;
+}
+
 #ifdef USE_ASSIMP // don't use this #define, it's only for me (it AssImp fails to compile on your machine, at least all the other tutorials still work)
 
 // Include AssImp
@@ -5,6 +5,12 @@ bool loadOBJ(const char* path, std::vector<glm::vec3>& out_vertices,
              std::vector<glm::vec2>& out_uvs,
              std::vector<glm::vec3>& out_normals);
 
+// indexed loadOBJ, reads the file at once and tokenizes it in place
+bool loadOBJIndexed(const char* path, std::vector<unsigned int>& out_indices,
+                    std::vector<glm::vec3>& out_vertices,
+                    std::vector<glm::vec2>& out_uvs,
+                    std::vector<glm::vec3>& out_normals);
+
 bool loadAssImp(const char* path, std::vector<unsigned short>& indices,
                 std::vector<glm::vec3>& vertices, std::vector<glm::vec2>& uvs,
                 std::vector<glm::vec3>& normals);
@@ -1,5 +1,8 @@
 #include <vector>
-#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
 
 #include <glm/glm.hpp>
 
@@ -8,26 +11,79 @@
 #include <string.h> // for memcmp
 
 
+// Tolerance of is_near, also the size of the cells of VertexWelder
+static const float WELD_EPSILON = 0.01f;
+
 // Returns true iif v1 can be considered equal to v2
 bool is_near(float v1, float v2){
-	return fabs( v1-v2 ) < 0.01f;
+	return fabs( v1-v2 ) < WELD_EPSILON;
 }
 
-// Searches through all already-exported vertices
-// for a similar one.
-// Similar = same position + same UVs + same normal
-bool getSimilarVertexIndex( 
-	glm::vec3 & in_vertex, 
-	glm::vec2 & in_uv, 
-	glm::vec3 & in_normal, 
-	std::vector<glm::vec3> & out_vertices,
-	std::vector<glm::vec2> & out_uvs,
-	std::vector<glm::vec3> & out_normals,
-	unsigned short & result
-){
-	// Lame linear search
-	for ( unsigned int i=0; i<out_vertices.size(); i++ ){
-		if (
+// Ends the chains of VertexWelder
+static const unsigned int NO_VERTEX = 0xFFFFFFFFu;
+
+// Finds already-exported vertices similar to a new one
+// (same position + same UVs + same normal, see is_near) through a spatial
+// hash of their positions. Cells are WELD_EPSILON wide, so a similar vertex
+// lies in the cell of the new one or a neighbor, and only those 27 cells
+// are searched instead of all vertices.
+class VertexWelder {
+public:
+	VertexWelder(
+		std::vector<glm::vec3> & out_vertices,
+		std::vector<glm::vec2> & out_uvs,
+		std::vector<glm::vec3> & out_normals
+	) : out_vertices(out_vertices), out_uvs(out_uvs), out_normals(out_normals) {}
+
+	// Returns the lowest index of a similar vertex, the one the linear
+	// search used to find
+	bool find(
+		glm::vec3 & in_vertex, 
+		glm::vec2 & in_uv, 
+		glm::vec3 & in_normal, 
+		unsigned int & result
+	){
+		bool found = false;
+		int32_t cx = cell(in_vertex.x), cy = cell(in_vertex.y), cz = cell(in_vertex.z);
+		for ( int32_t x=cx-1; x<=cx+1; x++ ){
+			for ( int32_t y=cy-1; y<=cy+1; y++ ){
+				for ( int32_t z=cz-1; z<=cz+1; z++ ){
+					std::unordered_map<uint64_t,unsigned int>::iterator it = heads.find(key(x,y,z));
+					if ( it == heads.end() ) continue;
+					for ( unsigned int i=it->second; i!=NO_VERTEX; i=next[i] ){
+						if ( (!found || i<result) && similar(in_vertex, in_uv, in_normal, i) ){
+							result = i;
+							found = true;
+						}
+					}
+				}
+			}
+		}
+		return found;
+	}
+
+	// Call after pushing a vertex to out_XXXX
+	void add(){
+		unsigned int i = (unsigned int)out_vertices.size() - 1;
+		glm::vec3 & v = out_vertices[i];
+		std::pair<std::unordered_map<uint64_t,unsigned int>::iterator,bool> it =
+			heads.insert(std::make_pair(key(cell(v.x), cell(v.y), cell(v.z)), i));
+		next.push_back( it.second ? NO_VERTEX : it.first->second );
+		it.first->second = i;
+	}
+
+private:
+	static int32_t cell(float v){
+		return (int32_t)std::floor((double)v / WELD_EPSILON);
+	}
+	// 21 bits per axis, cells far apart may share a key, which only costs
+	// a few more comparisons
+	static uint64_t key(int32_t x, int32_t y, int32_t z){
+		return ((uint64_t)(x & 0x1FFFFF) << 42) | ((uint64_t)(y & 0x1FFFFF) << 21) | (uint64_t)(z & 0x1FFFFF);
+	}
+
+	bool similar(glm::vec3 & in_vertex, glm::vec2 & in_uv, glm::vec3 & in_normal, unsigned int i){
+		return
 			is_near( in_vertex.x , out_vertices[i].x ) &&
 			is_near( in_vertex.y , out_vertices[i].y ) &&
 			is_near( in_vertex.z , out_vertices[i].z ) &&
@@ -35,33 +91,35 @@ bool getSimilarVertexIndex(
 			is_near( in_uv.y     , out_uvs     [i].y ) &&
 			is_near( in_normal.x , out_normals [i].x ) &&
 			is_near( in_normal.y , out_normals [i].y ) &&
-			is_near( in_normal.z , out_normals [i].z )
-		){
-			result = i;
-			return true;
-		}
+			is_near( in_normal.z , out_normals [i].z );
 	}
-	// No other vertex could be used instead.
-	// Looks like we'll have to add it to the VBO.
-	return false;
-}
+
+	std::vector<glm::vec3> & out_vertices;
+	std::vector<glm::vec2> & out_uvs;
+	std::vector<glm::vec3> & out_normals;
+	// First vertex of each cell, and the next vertex of the same cell
+	std::unordered_map<uint64_t,unsigned int> heads;
+	std::vector<unsigned int> next;
+};
 
 void indexVBO_slow(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<unsigned int> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
 ){
+	VertexWelder welder(out_vertices, out_uvs, out_normals);
+
 	// For each input vertex
 	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
 
 		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
+		unsigned int index;
+		bool found = welder.find(in_vertices[i], in_uvs[i], in_normals[i], index);
 
 		if ( found ){ // A similar vertex is already in the VBO, use it instead !
 			out_indices.push_back( index );
@@ -69,7 +127,8 @@ void indexVBO_slow(
 			out_vertices.push_back( in_vertices[i]);
 			out_uvs     .push_back( in_uvs[i]);
 			out_normals .push_back( in_normals[i]);
-			out_indices .push_back( (unsigned short)out_vertices.size() - 1 );
+			out_indices .push_back( (unsigned int)out_vertices.size() - 1 );
+			welder.add();
 		}
 	}
 }
@@ -78,17 +137,31 @@ struct PackedVertex{
 	glm::vec3 position;
 	glm::vec2 uv;
 	glm::vec3 normal;
-	bool operator<(const PackedVertex that) const{
-		return memcmp((void*)this, (void*)&that, sizeof(PackedVertex))>0;
+	bool operator==(const PackedVertex & that) const{
+		return memcmp((void*)this, (void*)&that, sizeof(PackedVertex))==0;
 	};
 };
 
+// FNV-1a over the bytes compared by PackedVertex::operator==
+struct PackedVertexHash{
+	size_t operator()(const PackedVertex & packed) const{
+		const unsigned char * bytes = (const unsigned char *)&packed;
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for ( size_t i=0; i<sizeof(PackedVertex); i++ ){
+			hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+		}
+		return (size_t)hash;
+	}
+};
+
+typedef std::unordered_map<PackedVertex,unsigned int,PackedVertexHash> VertexToOutIndexMap;
+
 bool getSimilarVertexIndex_fast( 
 	PackedVertex & packed, 
-	std::map<PackedVertex,unsigned short> & VertexToOutIndex,
-	unsigned short & result
+	VertexToOutIndexMap & VertexToOutIndex,
+	unsigned int & result
 ){
-	std::map<PackedVertex,unsigned short>::iterator it = VertexToOutIndex.find(packed);
+	VertexToOutIndexMap::iterator it = VertexToOutIndex.find(packed);
 	if ( it == VertexToOutIndex.end() ){
 		return false;
 	}else{
@@ -102,12 +175,13 @@ void indexVBO(
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<unsigned int> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
 ){
-	std::map<PackedVertex,unsigned short> VertexToOutIndex;
+	VertexToOutIndexMap VertexToOutIndex;
+	VertexToOutIndex.reserve(in_vertices.size());
 
 	// For each input vertex
 	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
@@ -116,7 +190,7 @@ void indexVBO(
 		
 
 		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
+		unsigned int index;
 		bool found = getSimilarVertexIndex_fast( packed, VertexToOutIndex, index);
 
 		if ( found ){ // A similar vertex is already in the VBO, use it instead !
@@ -125,7 +199,7 @@ void indexVBO(
 			out_vertices.push_back( in_vertices[i]);
 			out_uvs     .push_back( in_uvs[i]);
 			out_normals .push_back( in_normals[i]);
-			unsigned short newindex = (unsigned short)out_vertices.size() - 1;
+			unsigned int newindex = (unsigned int)out_vertices.size() - 1;
 			out_indices .push_back( newindex );
 			VertexToOutIndex[ packed ] = newindex;
 		}
@@ -145,19 +219,21 @@ void indexVBO_TBN(
 	std::vector<glm::vec3> & in_tangents,
 	std::vector<glm::vec3> & in_bitangents,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<unsigned int> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals,
 	std::vector<glm::vec3> & out_tangents,
 	std::vector<glm::vec3> & out_bitangents
 ){
+	VertexWelder welder(out_vertices, out_uvs, out_normals);
+
 	// For each input vertex
 	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
 
 		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
+		unsigned int index;
+		bool found = welder.find(in_vertices[i], in_uvs[i], in_normals[i], index);
 
 		if ( found ){ // A similar vertex is already in the VBO, use it instead !
 			out_indices.push_back( index );
@@ -171,7 +247,8 @@ void indexVBO_TBN(
 			out_normals .push_back( in_normals[i]);
 			out_tangents .push_back( in_tangents[i]);
 			out_bitangents .push_back( in_bitangents[i]);
-			out_indices .push_back( (unsigned short)out_vertices.size() - 1 );
+			out_indices .push_back( (unsigned int)out_vertices.size() - 1 );
+			welder.add();
 		}
 	}
 }
@@ -2,8 +2,11 @@
 #ifndef FSH_BITSET_HPP
 #define FSH_BITSET_HPP
 
+#include <cmath>
+#include <cstring>
 #include <vector>
 #include <iostream>
+#include "util.hpp"
 
 #define BIT_CAPACITY(type) (sizeof(type) * 8)
 
@@ -20,13 +23,23 @@ namespace fsh {
             return sizeof(*this) + sizeof(typename decltype(data)::value_type) *
                                        data.capacity();
         }
-        bitset() : size(0) {}
+        bitset() : size(0), data_size(0) {}
         bitset(size_t size)
             : size(size),
               data(std::ceil(1.0 * size / BIT_CAPACITY(scaler)), 0),
               data_size(data.size()) {
             // data_size = data.size();
         }
+        size_t bits() const { return size; }
+        // makes room for size bits, the new ones are clear
+        void grow(size_t size) {
+            if (size <= this->size) {
+                return;
+            }
+            this->size = size;
+            data.resize(std::ceil(1.0 * size / BIT_CAPACITY(scaler)), 0);
+            data_size = data.size();
+        }
         bitset& add(size_t k) {
             if (k >= size) {
                 std::cout << "error in bitset: add" << std::endl;
@@ -47,6 +60,14 @@ namespace fsh {
             data[pos] &= ((scaler)-1 ^ ((scaler)1 << cur));
             return *this;
         }
+        bool test(size_t k) const {
+            if (k >= size) {
+                return false;
+            }
+            size_t pos = k / BIT_CAPACITY(scaler);
+            size_t cur = k % BIT_CAPACITY(scaler);
+            return data[pos] >> cur & 1;
+        }
         bitset operator&(const bitset& rhs) const {
             bitset ret(size);
             if (size != rhs.size) {
@@ -73,6 +94,37 @@ namespace fsh {
             }
             return ret;
         }
+        // find_fist() of the intersection of sets[0..count), which must all
+        // have the same size, without building the intersection
+        static int find_first_common(const bitset* const* sets, size_t count) {
+            const size_t n = sets[0]->data_size;
+            size_t i = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+                uint64_t word;
+                std::memcpy(&word, sets[0]->data.data() + i, sizeof(word));
+                for (size_t k = 1; k < count && word; k++) {
+                    uint64_t other;
+                    std::memcpy(&other, sets[k]->data.data() + i,
+                                sizeof(other));
+                    word &= other;
+                }
+                if (word) {
+                    return i * BIT_CAPACITY(scaler) + __builtin_ctzll(word);
+                }
+            }
+#endif
+            for (; i < n; i++) {
+                scaler word = sets[0]->data[i];
+                for (size_t k = 1; k < count; k++) {
+                    word &= sets[k]->data[i];
+                }
+                if (word) {
+                    return i * BIT_CAPACITY(scaler) + __builtin_ctz(word);
+                }
+            }
+            return -1;
+        }
         int find_last() const {
             int ret = -1;
             for (size_t i = 0; i < data_size && ret == -1; i++) {
@@ -89,6 +141,15 @@ namespace fsh {
             }
             return ret;
         }
+        void save(std::ostream& out) const {
+            write_pod(out, size);
+            write_pod_array(out, data.data(), data_size);
+        }
+        static bitset load(const char*& cursor) {
+            bitset ret(read_pod<size_t>(cursor));
+            read_pod_array(cursor, ret.data.data(), ret.data_size);
+            return ret;
+        }
         void display() const {
             for (size_t i = 0; i < size; i++) {
                 size_t pos = i / BIT_CAPACITY(scaler);
@@ -0,0 +1,61 @@
+#pragma once
+#ifndef FSH_COLOR_HPP
+#define FSH_COLOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace fsh {
+    // packed voxel colors to store as map contents. channels come in and go
+    // out as floats in [0, 1]
+    namespace color_helpers {
+        inline uint32_t quantize(float u, uint32_t max) {
+            return (uint32_t)std::lround(std::clamp(u, 0.0f, 1.0f) * max);
+        }
+    }  // namespace color_helpers
+
+    // 8 bits per channel
+    struct rgba8 {
+        uint8_t r, g, b, a;
+
+        static rgba8 pack(float r, float g, float b, float a = 1.0f) {
+            using color_helpers::quantize;
+            return {uint8_t(quantize(r, 255)), uint8_t(quantize(g, 255)),
+                    uint8_t(quantize(b, 255)), uint8_t(quantize(a, 255))};
+        }
+        // writes r, g and b to out
+        void unpack(float* out) const {
+            out[0] = r * (1.0f / 255);
+            out[1] = g * (1.0f / 255);
+            out[2] = b * (1.0f / 255);
+        }
+    };
+
+    // 5 bits of red, 6 of green and 5 of blue in one 16 bit word
+    struct rgb565 {
+        uint16_t bits;
+
+        static rgb565 pack(float r, float g, float b) {
+            using color_helpers::quantize;
+            return {uint16_t(quantize(r, 31) << 11 | quantize(g, 63) << 5 |
+                             quantize(b, 31))};
+        }
+        void unpack(float* out) const {
+            out[0] = (bits >> 11) * (1.0f / 31);
+            out[1] = (bits >> 5 & 63) * (1.0f / 63);
+            out[2] = (bits & 31) * (1.0f / 31);
+        }
+    };
+
+    // decodes count packed colors into 3 floats each, the layout of a GL
+    // vertex buffer of vec3 colors
+    template <class Color>
+    void unpack_colors(const Color* colors, size_t count, float* out) {
+        for (size_t i = 0; i < count; i++) {
+            colors[i].unpack(out + 3 * i);
+        }
+    }
+}  // namespace fsh
+
+#endif
@@ -0,0 +1,171 @@
+#pragma once
+#ifndef FSH_DYNAMIC_HPP
+#define FSH_DYNAMIC_HPP
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "fsh.hpp"
+
+namespace fsh {
+    // an fsh::map that takes edits. insert() and erase() go straight into
+    // the map (see map::insert), and once more than rebuild_threshold keys
+    // sit in its overflow table a new map of all keys is built on a
+    // background thread. edits made meanwhile are replayed onto the new map
+    // before it replaces the old one, which happens on the next call after
+    // the rebuild finished. a dynamic_map belongs to one thread, publish
+    // its maps through fsh::versioned to share them with readers
+    template <uint d, class T, class PosInt, class NorInt, class HashInt>
+    class dynamic_map {
+    public:
+        using base_map = map<d, T, PosInt, NorInt, HashInt>;
+        using data_t = typename base_map::data_t;
+        using data_function = typename base_map::data_function;
+        using IndexInt = size_t;
+
+    private:
+        // every key with its normal, the source of rebuilds
+        std::unordered_map<point<d, PosInt>, data_t> keys;
+        std::unique_ptr<base_map> current;
+        size_t threshold;
+        size_t rebuild_count;
+        std::future<std::unique_ptr<base_map>> pending;
+        // edits since the pending rebuild took its copy of keys, true for
+        // an insert
+        std::vector<std::pair<bool, data_t>> journal;
+
+        static std::unique_ptr<base_map> build(std::vector<data_t> data) {
+            point<d, PosInt> box = point<d, PosInt>::repeating(1);
+            for (const auto& it : data) {
+                for (uint i = 0; i < d; i++) {
+                    box[i] = std::max(box[i], it.location[i]);
+                }
+            }
+            return std::make_unique<base_map>(
+                [&](IndexInt i) { return data[i]; }, data.size(), box);
+        }
+
+        static void apply(base_map& m, bool insert, const data_t& it) {
+            if (insert) {
+                m.insert(it);
+            } else {
+                m.erase(it.location);
+            }
+        }
+
+        void edited(bool insert, const data_t& it) {
+            if (pending.valid()) {
+                journal.emplace_back(insert, it);
+                poll();
+            } else if (current->overflow_size() > threshold) {
+                rebuild();
+            }
+        }
+
+    public:
+        dynamic_map(const data_function& data, IndexInt n,
+                    point<d, PosInt> box, size_t rebuild_threshold = 1024)
+            : current(std::make_unique<base_map>(data, n, box)),
+              threshold(rebuild_threshold),
+              rebuild_count(0) {
+            for (IndexInt i = 0; i < n; i++) {
+                const data_t it = data(i);
+                keys[it.location] = it;
+            }
+        }
+        // waits for a rebuild still in flight
+        ~dynamic_map() {
+            if (pending.valid()) {
+                pending.wait();
+            }
+        }
+
+        const T* find(const point<d, PosInt>& p) const {
+            return current->find(p);
+        }
+
+        const T& get(const point<d, PosInt>& p) const {
+            return current->get(p);
+        }
+
+        // adds it, or replaces the contents of its location, and returns
+        // whether the location is new
+        bool insert(const data_t& it) {
+            keys[it.location] = it;
+            const bool ret = current->insert(it);
+            edited(true, it);
+            return ret;
+        }
+
+        bool erase(const point<d, PosInt>& p) {
+            auto it = keys.find(p);
+            if (it == keys.end()) {
+                return false;
+            }
+            const data_t erased = it->second;
+            keys.erase(it);
+            current->erase(p);
+            edited(false, erased);
+            return true;
+        }
+
+        // starts a background rebuild of all keys unless one is running
+        void rebuild() {
+            if (pending.valid() || keys.empty()) {
+                return;
+            }
+            std::vector<data_t> data;
+            data.reserve(keys.size());
+            for (const auto& it : keys) {
+                data.push_back(it.second);
+            }
+            journal.clear();
+            pending = std::async(std::launch::async, build, std::move(data));
+        }
+
+        // swaps in the result of a finished rebuild, returns whether it did
+        bool poll() {
+            if (!pending.valid() || pending.wait_for(std::chrono::seconds(
+                                        0)) != std::future_status::ready) {
+                return false;
+            }
+            std::unique_ptr<base_map> next = pending.get();
+            for (const auto& it : journal) {
+                apply(*next, it.first, it.second);
+            }
+            journal.clear();
+            current = std::move(next);
+            rebuild_count++;
+            return true;
+        }
+
+        // blocks until a running rebuild is swapped in
+        void wait() {
+            if (pending.valid()) {
+                pending.wait();
+                poll();
+            }
+        }
+
+        bool rebuilding() const { return pending.valid(); }
+        size_t rebuilds() const { return rebuild_count; }
+        size_t size() const { return keys.size(); }
+        size_t overflow_size() const { return current->overflow_size(); }
+        const base_map& table() const { return *current; }
+
+        size_t memory_size() const {
+            return sizeof(*this) + current->memory_size() +
+                   (sizeof(typename decltype(keys)::value_type) +
+                    sizeof(void*)) *
+                       keys.size() +
+                   sizeof(void*) * keys.bucket_count() +
+                   sizeof(typename decltype(journal)::value_type) *
+                       journal.capacity();
+        }
+    };
+}  // namespace fsh
+
+#endif
@@ -3,12 +3,17 @@
 #define FSH_HPP
 
 #include <string>
+#include <type_traits>
 #include <functional>
 #include <iostream>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
 #include <queue>
+#include <set>
+#include <map>
+#include <cassert>
+#include <numeric>
 #include "point.hpp"
 #include "util.hpp"
 #include "bitset.hpp"
@@ -19,6 +24,29 @@
     throw std::out_of_range("Element not found in map")
 
 namespace fsh {
+    // order of the slots of H inside each surface of the box
+    enum class layout {
+        row_major,
+        // tiles of 8 x 8 surface points in row-major order, z-order inside
+        // each tile, so neighbouring surface points share cache lines
+        morton
+    };
+
+    // contents of an entry of H. an empty T, like the none of fsh::set,
+    // is a base class so it takes no space in the entry
+    template <class T,
+              bool = std::is_empty<T>::value && !std::is_final<T>::value>
+    struct payload {
+        T contents;
+        T& value() { return contents; }
+        const T& value() const { return contents; }
+    };
+    template <class T>
+    struct payload<T, true> : T {
+        T& value() { return *this; }
+        const T& value() const { return *this; }
+    };
+
     // creates a perfect hash for a predefined data set
     // d is the dimensionality, T is the data type
     // PosInt is the integer type used for positions
@@ -45,6 +73,16 @@ namespace fsh {
         // normal table
         std::vector<point<d, NorInt>> normals;
 
+        // integer projection constants, one per normal. with coordinates
+        // below 2^16 and |den| <= 128 every numerator stays below 2^25, so
+        // (x * recip) >> step_shift is an exact division by den
+        static constexpr uint step_shift = 38;
+        struct normal_step {
+            uint den[d];
+            uint64_t recip[d];
+        };
+        std::vector<normal_step> steps;
+
         class entry;
         class redirct_entry;
 
@@ -54,6 +92,19 @@ namespace fsh {
         // redirct table
         std::vector<redirct_entry> phi;
 
+        // surface layout of H, derived from box by update_layout()
+        layout slot_layout;
+        static constexpr uint tile_bits = 3;
+        size_t surface_addr[2 * d];
+        size_t surface_stride[d][d];
+
+        // keys insert() could not place in H, by location
+        std::unordered_map<point<d, PosInt>, T> overflow;
+        // slots of H that insert() may use for redirected entries, erased
+        // ones first, then the ones after free_cursor
+        std::vector<size_t> free_slots;
+        size_t free_cursor = 0;
+
     public:
         struct data_t {
             point<d, PosInt> location;
@@ -67,8 +118,11 @@ namespace fsh {
         };
         using data_function = std::function<data_t(IndexInt)>;
 
-        map(const data_function& data, IndexInt n, point<d, PosInt> box)
-            : n(n), offset(0), box(box) {
+        // with max_normals set, the normals of the data are clustered into
+        // at most that many, see cluster_normals()
+        map(const data_function& data, IndexInt n, point<d, PosInt> box,
+            layout slot_layout = layout::row_major, size_t max_normals = 0)
+            : n(n), offset(0), box(box), slot_layout(slot_layout) {
             // for (int i = 0; i < d; i++) {
             //     box[i] = 0;
             // }
@@ -82,51 +136,222 @@ namespace fsh {
                 box = box + (PosInt)(2 * d);
                 offset += d;
             }
-            create_normal_table(data);
-            while (!create(data)) {
+            const bool clustered = create_normal_table(data, max_normals);
+            bool ok = create(data);
+            // fewer normals mean fuller buckets, so the full table is tried
+            // before the box grows
+            if (!ok && clustered) {
+                create_normal_table(data, 0);
+                ok = create(data);
+            }
+            while (!ok) {
                 box = box + (PosInt)(2 * d);
                 offset += d;
                 VALUE(box);
+                ok = create(data);
             }
         }
 
-        const T& get(const point<d, PosInt>& p) const { return get(p); }
+        // lookups never allocate or write to the map, so any number of
+        // threads can call the const overloads on one shared map as long as
+        // nobody calls insert() or erase() at the same time
+        const T& get(const point<d, PosInt>& p) const {
+            const T* ret = find(p);
+            if (ret == nullptr) {
+                NOT_FOUND_EXCEPTION();
+            }
+            return *ret;
+        }
 
         T& get(const point<d, PosInt>& p) {
-            for (uint i = 0; i < d; i++) {
-                if (p[i] >= normal_indices[i].size()) {
-                    NOT_FOUND_EXCEPTION();
+            return const_cast<T&>(static_cast<const map&>(*this).get(p));
+        }
+
+        // returns nullptr instead of throwing when p is not in the map
+        const T* find(const point<d, PosInt>& p) const {
+            if (!overflow.empty()) {
+                auto it = overflow.find(p);
+                if (it != overflow.end()) {
+                    return &it->second;
                 }
             }
-            int index = get_normal_index(p);
-            if (index == -1) {
-                NOT_FOUND_EXCEPTION();
+            query q;
+            if (!prepare(p, q)) return nullptr;
+            resolve_home(q);
+            if (q.R_index != 0) {
+                resolve_redirect(q);
             }
-            const point<d, NorInt>& vn = normals[index];
-            point<d, PosInt> surface_point = p;
-            PosInt dist = move_to_box(surface_point, vn);
-            size_t H_index = h(surface_point);
-            entry& en = H[H_index];
-            if (en.redirct_index == 0) {
-                if (en.redirected == false && en.equals(vn, dist)) {
-                    return en.contents;
-                } else {
-                    NOT_FOUND_EXCEPTION();
+            return q.found;
+        }
+
+        // looks up count points, out[i] is set as find(ps[i]) would.
+        // queries run in groups through a staged pipeline and the next stage
+        // of every query in a group is prefetched before any of them is
+        // resolved, so the dependent reads of H and phi overlap
+        void find_many(const point<d, PosInt>* ps, size_t count,
+                       const T** out) const {
+            constexpr size_t batch = 16;
+            query q[batch];
+            for (size_t base = 0; base < count; base += batch) {
+                const size_t m = std::min(batch, count - base);
+                // stage 1: surface slots
+                for (size_t i = 0; i < m; i++) {
+                    if (prepare(ps[base + i], q[i])) {
+                        FSH_PREFETCH(&H[q[i].H_index]);
+                    }
                 }
-            } else {
-                size_t R_index = en.redirct_index - 1;
-                const redirct_entry& re = phi[R_index];
-                H_index = re.redirect[re.h(vn, dist)];
-                if (H_index == 0) NOT_FOUND_EXCEPTION();
-                entry& en2 = H[H_index];
-                if (en2.equals(vn, dist)) {
-                    return en2.contents;
-                } else {
-                    NOT_FOUND_EXCEPTION();
+                // stage 2: home entries
+                bool redirected = false;
+                for (size_t i = 0; i < m; i++) {
+                    if (q[i].H_index == size_t(-1)) continue;
+                    resolve_home(q[i]);
+                    if (q[i].R_index != 0) {
+                        FSH_PREFETCH(&phi[q[i].R_index - 1]);
+                        redirected = true;
+                    }
+                }
+                if (redirected) {
+                    // stage 3: redirect tables
+                    for (size_t i = 0; i < m; i++) {
+                        if (q[i].R_index == 0) continue;
+                        const redirct_entry& re = phi[q[i].R_index - 1];
+                        q[i].H_index = re.h(*q[i].vn, q[i].dist);
+                        FSH_PREFETCH(&re.redirect[q[i].H_index]);
+                    }
+                    // stage 4: redirected entries
+                    for (size_t i = 0; i < m; i++) {
+                        if (q[i].R_index == 0) continue;
+                        const redirct_entry& re = phi[q[i].R_index - 1];
+                        q[i].H_index = re.redirect[q[i].H_index];
+                        if (q[i].H_index != 0) {
+                            FSH_PREFETCH(&H[q[i].H_index - 1]);
+                        }
+                    }
+                    // stage 5: verify
+                    for (size_t i = 0; i < m; i++) {
+                        if (q[i].R_index == 0) continue;
+                        verify_redirected(q[i]);
+                    }
+                }
+                for (size_t i = 0; i < m; i++) {
+                    out[base + i] = q[i].found;
+                }
+                if (!overflow.empty()) {
+                    for (size_t i = 0; i < m; i++) {
+                        auto it = overflow.find(ps[base + i]);
+                        if (it != overflow.end()) {
+                            out[base + i] = &it->second;
+                        }
+                    }
+                }
+            }
+        }
+
+        // adds p to the map, or replaces its contents if it is already
+        // there, and returns whether p is new. like lookups, keys in H are
+        // told apart by their normal and distance only, so p replaces a key
+        // it cannot be told apart from. p goes into a free slot of H when
+        // its home slot is free, otherwise into the redirect bucket of its
+        // home slot, re-solving the k of that bucket only. a point whose
+        // rows have no normal in common gets the normal of it, see
+        // add_normal(). points outside the box, with a zero normal or whose
+        // bucket cannot be solved go into an overflow table that a rebuild
+        // folds back in
+        bool insert(const data_t& it) {
+            const point<d, PosInt>& p = it.location;
+            const T& contents = it.contents;
+            auto spilled = overflow.find(p);
+            if (spilled != overflow.end()) {
+                spilled->second = contents;
+                return false;
+            }
+            query q;
+            bool ok = prepare(p, q);
+            if (!ok && in_box(p) &&
+                it.normal != point<d, NorInt>::point_zero()) {
+                add_normal(p, it.normal);
+                ok = prepare(p, q);
+            }
+            if (ok) {
+                const entry_verify verify(*q.vn, q.dist);
+                const size_t slot = find_slot(q.H_index, verify);
+                if (slot != size_t(-1)) {
+                    H[slot].value() = contents;
+                    return false;
+                }
+                if (place(q.H_index, verify, contents)) {
+                    n++;
+                    return true;
+                }
+            }
+            overflow.emplace(p, contents);
+            return true;
+        }
+
+        // removes p from the map, returns whether it was there
+        bool erase(const point<d, PosInt>& p) {
+            if (overflow.erase(p)) {
+                return true;
+            }
+            query q;
+            if (!prepare(p, q)) {
+                return false;
+            }
+            const entry_verify verify(*q.vn, q.dist);
+            const size_t slot = find_slot(q.H_index, verify);
+            if (slot == size_t(-1)) {
+                return false;
+            }
+            const size_t r = H[q.H_index].redirct_index;
+            if (r != 0) {
+                phi[r - 1].redirect[phi[r - 1].h(verify)] = 0;
+            }
+            H[slot].verify = entry_verify();
+            H[slot].value() = T();
+            H[slot].redirected = false;
+            free_slots.push_back(slot);
+            n--;
+            return true;
+        }
+
+        // moves every point of ps onto box along vn with move_to_box() and
+        // with the reference move_to_box_double() and returns how many of
+        // them end up elsewhere or at another distance. every p + offset
+        // must lie in box
+        static size_t projection_mismatches(
+            const point<d, PosInt>& box, PosInt offset,
+            const point<d, NorInt>& vn,
+            const std::vector<point<d, PosInt>>& ps) {
+            map m;
+            m.box = box;
+            m.offset = offset;
+            m.normals = {vn};
+            m.update_steps();
+            size_t ret = 0;
+            for (const auto& p : ps) {
+                point<d, PosInt> fast = p, exact = p;
+                const PosInt dist = m.move_to_box(fast, 0);
+                if (dist != m.move_to_box_double(exact, vn) || fast != exact) {
+                    ret++;
                 }
             }
+            return ret;
         }
 
+        size_t normal_count() const { return normals.size(); }
+        // bits of the per coordinate normal indices, one per normal for
+        // every coordinate of every axis
+        size_t normal_index_bits() const {
+            size_t rows = 0;
+            for (uint i = 0; i < d; i++) {
+                rows += normal_indices[i].size();
+            }
+            return rows * normals.size();
+        }
+
+        // number of keys insert() had to put into the overflow table
+        size_t overflow_size() const { return overflow.size(); }
+
         size_t memory_size() const {
             size_t ret = sizeof(*this);
             for (uint i = 0; i < d; i++) {
@@ -135,20 +360,157 @@ namespace fsh {
             }
             ret += sizeof(typename decltype(normals)::value_type) *
                    normals.capacity();
+            ret += sizeof(typename decltype(steps)::value_type) *
+                   steps.capacity();
             ret += sizeof(typename decltype(H)::value_type) * H.capacity();
             ret += sizeof(typename decltype(phi)::value_type) * phi.capacity();
+            ret += (sizeof(typename decltype(overflow)::value_type) +
+                    sizeof(void*)) *
+                       overflow.size() +
+                   sizeof(void*) * overflow.bucket_count();
+            ret += sizeof(typename decltype(free_slots)::value_type) *
+                   free_slots.capacity();
+            return ret;
+        }
+
+        // writes the map in a flat binary form that load() reads back,
+        // T must be trivially copyable
+        void save(std::ostream& out) const {
+            write_pod(out, box);
+            write_pod(out, n);
+            write_pod(out, offset);
+            write_pod(out, slot_layout);
+            for (uint i = 0; i < d; i++) {
+                write_pod(out, normal_indices[i].size());
+                for (const auto& it : normal_indices[i]) {
+                    it.save(out);
+                }
+            }
+            write_pod(out, normals.size());
+            write_pod_array(out, normals.data(), normals.size());
+            write_pod(out, H.size());
+            write_pod_array(out, H.data(), H.size());
+            write_pod(out, phi.size());
+            for (const auto& it : phi) {
+                write_pod(out, it.k);
+                write_pod(out, it.redirect.size());
+                write_pod_array(out, it.redirect.data(), it.redirect.size());
+            }
+            write_pod(out, overflow.size());
+            for (const auto& it : overflow) {
+                write_pod(out, it.first);
+                write_pod(out, it.second);
+            }
+        }
+
+        // rebuilds a map from bytes written by save(), e.g. a mapped file,
+        // and advances cursor past them
+        static map load(const char*& cursor) {
+            map ret;
+            ret.box = read_pod<point<d, PosInt>>(cursor);
+            ret.n = read_pod<IndexInt>(cursor);
+            ret.offset = read_pod<PosInt>(cursor);
+            ret.slot_layout = read_pod<layout>(cursor);
+            for (uint i = 0; i < d; i++) {
+                ret.normal_indices[i].resize(read_pod<size_t>(cursor));
+                for (auto& it : ret.normal_indices[i]) {
+                    it = bitset::load(cursor);
+                }
+            }
+            ret.normals.resize(read_pod<size_t>(cursor));
+            read_pod_array(cursor, ret.normals.data(), ret.normals.size());
+            ret.H.resize(read_pod<size_t>(cursor));
+            read_pod_array(cursor, ret.H.data(), ret.H.size());
+            ret.phi.resize(read_pod<size_t>(cursor));
+            for (auto& it : ret.phi) {
+                it.k = read_pod<HashInt>(cursor);
+                it.redirect.resize(read_pod<size_t>(cursor));
+                read_pod_array(cursor, it.redirect.data(), it.redirect.size());
+            }
+            const size_t spilled = read_pod<size_t>(cursor);
+            for (size_t i = 0; i < spilled; i++) {
+                const point<d, PosInt> p = read_pod<point<d, PosInt>>(cursor);
+                ret.overflow.emplace(p, read_pod<T>(cursor));
+            }
+            ret.update_steps();
+            ret.update_layout();
             return ret;
         }
 
     private:
+        map() {}
+
+        // state of a single lookup while it moves through the stages
+        struct query {
+            const point<d, NorInt>* vn;
+            PosInt dist;
+            size_t H_index;
+            size_t R_index;
+            const T* found;
+        };
+        bool prepare(const point<d, PosInt>& p, query& q) const {
+            q.H_index = size_t(-1);
+            q.R_index = 0;
+            q.found = nullptr;
+            if (!in_box(p)) {
+                return false;
+            }
+            int index = get_normal_index(p);
+            if (index == -1) {
+                return false;
+            }
+            q.vn = &normals[index];
+            point<d, PosInt> surface_point = p;
+            q.dist = move_to_box(surface_point, index);
+            q.H_index = h(surface_point);
+            return true;
+        }
+        bool in_box(const point<d, PosInt>& p) const {
+            for (uint i = 0; i < d; i++) {
+                if (p[i] >= normal_indices[i].size() ||
+                    (size_t)p[i] + offset > box[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        void resolve_home(query& q) const {
+            const entry& en = H[q.H_index];
+            if (en.redirct_index == 0) {
+                if (en.redirected == false && en.equals(*q.vn, q.dist)) {
+                    q.found = &en.value();
+                }
+            } else {
+                q.R_index = en.redirct_index;
+            }
+        }
+        void resolve_redirect(query& q) const {
+            const redirct_entry& re = phi[q.R_index - 1];
+            q.H_index = re.redirect[re.h(*q.vn, q.dist)];
+            verify_redirected(q);
+        }
+        void verify_redirected(query& q) const {
+            if (q.H_index == 0) return;
+            const entry& en = H[q.H_index - 1];
+            if (en.equals(*q.vn, q.dist)) {
+                q.found = &en.value();
+            }
+        }
         size_t hash_table_size() const {
+            if (slot_layout == layout::morton) {
+                size_t sz = 0;
+                for (uint i = 0; i < d; i++) {
+                    sz += tiled_surface_size(i) * 2;
+                }
+                return sz;
+            }
             size_t mul = 1;
             for (uint i = 0; i < d; i++) {
                 mul *= (size_t)box[i] + 1;
             }
             size_t sz = 0;
             for (uint i = 0; i < d; i++) {
-                sz += mul / box[i] * 2;
+                sz += mul / ((size_t)box[i] + 1) * 2;
             }
             return sz;
         }
@@ -174,12 +536,12 @@ namespace fsh {
             }
             friend class redirct_entry;
         };
-        struct entry {
+        struct entry : payload<T> {
             entry_verify verify;
-            size_t redirct_index;
-            T contents;
             bool redirected;
-            entry() : redirct_index(0), redirected(false) {}
+            // phi index + 1 of the bucket of this slot, 0 if it has none
+            uint32_t redirct_index;
+            entry() : redirected(false), redirct_index(0) {}
             bool equals(const point<d, NorInt>& nor, PosInt dist) const {
                 return equals(entry_verify(nor, dist));
             }
@@ -191,6 +553,7 @@ namespace fsh {
         // };
 
         struct redirct_entry {
+            // H index + 1 of every entry of the bucket, 0 if unused
             std::vector<size_t> redirect;
             HashInt k;
             redirct_entry() : k(1) {}
@@ -220,30 +583,129 @@ namespace fsh {
             redirct_entry_large(size_t index) : redirct_entry(), index(index) {}
         };
 
-        void create_normal_table(const data_function& data) {
+        // returns whether the normals had to be clustered to stay within
+        // max_normals, 0 for no limit
+        bool create_normal_table(const data_function& data,
+                                 size_t max_normals) {
             std::unordered_map<point<d, NorInt>, size_t> m;
-            int nnormal = 0;
+            std::vector<point<d, NorInt>> found;
+            std::vector<size_t> count;
             for (size_t i = 0; i < n; i++) {
                 const data_t& it = data(i);
-                if (!m.count(it.normal)) {
-                    m[it.normal] = nnormal++;
+                auto ins = m.emplace(it.normal, found.size());
+                if (ins.second) {
                     assert((it.normal != point<d, NorInt>::point_zero()));
+                    found.push_back(it.normal);
+                    count.push_back(0);
                 }
+                count[ins.first->second]++;
+            }
+            // index in normals of every found normal
+            std::vector<size_t> slot(found.size());
+            const bool clustered = max_normals && found.size() > max_normals;
+            if (clustered) {
+                cluster_normals(found, count, max_normals, slot);
+            } else {
+                normals = found;
+                std::iota(slot.begin(), slot.end(), size_t(0));
             }
             for (int i = 0; i < d; i++) {
                 point<d, PosInt> bound = box + (PosInt)1;
                 normal_indices[i].clear();
-                normal_indices[i].resize(bound[i], bitset(nnormal));
+                normal_indices[i].resize(bound[i], bitset(normals.size()));
             }
             for (size_t i = 0; i < n; i++) {
                 const data_t& it = data(i);
                 for (uint j = 0; j < d; j++) {
-                    normal_indices[j][it.location[j]].add(m[it.normal]);
+                    normal_indices[j][it.location[j]].add(
+                        slot[m[it.normal]]);
                 }
             }
-            normals.resize(nnormal);
-            for (const auto& it : m) {
-                normals[it.second] = it.first;
+            update_steps();
+            return clustered;
+        }
+        // keeps the max_normals normals most points have and gives every
+        // other one the kept normal closest in angle. any normal finds a
+        // point again, the normal only decides where on the box it lands
+        void cluster_normals(const std::vector<point<d, NorInt>>& found,
+                             const std::vector<size_t>& count,
+                             size_t max_normals, std::vector<size_t>& slot) {
+            std::vector<size_t> order(found.size());
+            std::iota(order.begin(), order.end(), size_t(0));
+            std::stable_sort(order.begin(), order.end(),
+                             [&](size_t a, size_t b) {
+                                 return count[a] > count[b];
+                             });
+            auto unit = [](const point<d, NorInt>& vn) {
+                point<d, double> u;
+                double len = 0;
+                for (uint i = 0; i < d; i++) {
+                    len += double(vn[i]) * vn[i];
+                }
+                len = std::sqrt(len);
+                for (uint i = 0; i < d; i++) {
+                    u[i] = vn[i] / len;
+                }
+                return u;
+            };
+            normals.clear();
+            std::vector<point<d, double>> kept;
+            for (size_t r = 0; r < max_normals; r++) {
+                slot[order[r]] = r;
+                normals.push_back(found[order[r]]);
+                kept.push_back(unit(found[order[r]]));
+            }
+            for (size_t j = max_normals; j < order.size(); j++) {
+                const point<d, double> u = unit(found[order[j]]);
+                size_t best = 0;
+                double best_cos = -2;
+                for (size_t r = 0; r < kept.size(); r++) {
+                    double c = 0;
+                    for (uint i = 0; i < d; i++) {
+                        c += u[i] * kept[r][i];
+                    }
+                    if (c > best_cos) {
+                        best_cos = c;
+                        best = r;
+                    }
+                }
+                slot[order[j]] = best;
+            }
+        }
+        // gives p's rows a normal in common, vn. a stored key keeps the
+        // first normal its rows have in common, so only the bit of the last
+        // normal can be set without moving one: vn is that normal if it is
+        // the last one, else it is appended. the rows grow by half when
+        // they run out of bits
+        void add_normal(const point<d, PosInt>& p,
+                        const point<d, NorInt>& vn) {
+            if (normals.empty() || normals.back() != vn) {
+                normals.push_back(vn);
+                update_steps(normals.size() - 1);
+                const size_t bits = normal_indices[0][0].bits();
+                if (normals.size() > bits) {
+                    const size_t grown = std::max(normals.size(), bits * 3 / 2);
+                    for (uint i = 0; i < d; i++) {
+                        for (auto& row : normal_indices[i]) {
+                            row.grow(grown);
+                        }
+                    }
+                }
+            }
+            for (uint i = 0; i < d; i++) {
+                normal_indices[i][p[i]].add(normals.size() - 1);
+            }
+        }
+        // steps of the normals from from on
+        void update_steps(size_t from = 0) {
+            steps.resize(normals.size());
+            for (size_t i = from; i < normals.size(); i++) {
+                for (uint j = 0; j < d; j++) {
+                    uint den = std::abs(normals[i][j]);
+                    steps[i].den[j] = den;
+                    steps[i].recip[j] =
+                        den ? ((uint64_t(1) << step_shift) + den - 1) / den : 0;
+                }
             }
         }
         bool on_box(point<d, PosInt>& v) const {
@@ -274,27 +736,100 @@ namespace fsh {
             }
             v[minid / 2] = minid % 2 ? box[minid / 2] : 0;
         }
-        PosInt move_to_box(point<d, PosInt>& v,
-                           const point<d, NorInt>& vn) const {
-            PosInt maxbox = std::max(box[0], std::max(box[1], box[2]));
-            double len = maxbox;
+        // reference projection, move_to_box() must give the same result
+        PosInt move_to_box_double(point<d, PosInt>& v,
+                                  const point<d, NorInt>& vn) const {
+            double len = 0;
+            uint axis = d;
+            PosInt num = 0;
             v += offset;
             for (uint i = 0; i < d; i++) {
-                double move = len;
-                if (vn[i] > 0) {
-                    move = ((double)box[i] - (double)v[i]) / (double)vn[i];
-                } else if (vn[i] < 0) {
-                    move = (0.0 - (double)v[i]) / (double)vn[i];
+                if (vn[i] == 0) continue;
+                const PosInt ni = vn[i] > 0 ? box[i] - v[i] : v[i];
+                const double move = (double)ni / std::abs((double)vn[i]);
+                if (axis == d || move < len) {
+                    len = move;
+                    axis = i;
+                    num = ni;
                 }
-                len = std::min(len, move);
             }
             for (uint i = 0; i < d; i++) {
                 v[i] += std::round(len * vn[i]);
             }
             assert(on_box(v));
-            return (PosInt)std::round(len * ((unsigned)PosInt(-1) >> 4));
+            return distance_key(num, axis);
         }
-        constexpr size_t find_surface(const point<d, PosInt>& v) const {
+        // the verify distance of a move: the integer distance num of the
+        // limiting axis to its face, and that axis. together with the
+        // normal and the surface point they give back the point exactly,
+        // so two points never share an entry_verify. num stays below
+        // 2^(bits of PosInt - axis_bits) for any box that fits
+        static constexpr uint axis_bits = d <= 2 ? 1 : d <= 4 ? 2 : 3;
+        static PosInt distance_key(uint64_t num, uint axis) {
+            return PosInt(num << axis_bits | axis);
+        }
+        // moves v along normal normal_id until it hits the box and returns
+        // distance_key() of the move. the travelled length is the
+        // exact fraction num / den, so everything is done with integer
+        // multiply-shifts by the reciprocals in steps. exact .5 ties fall
+        // back to the double math so they round the way it does. define
+        // FSH_CHECK_PROJECTION to assert every call against the double math
+        PosInt move_to_box(point<d, PosInt>& v, size_t normal_id) const {
+            const point<d, NorInt>& vn = normals[normal_id];
+            if constexpr (sizeof(PosInt) > 2 || sizeof(NorInt) > 1) {
+                return move_to_box_double(v, vn);
+            }
+#ifdef FSH_CHECK_PROJECTION
+            point<d, PosInt> expected = v;
+            PosInt expected_dist = move_to_box_double(expected, vn);
+#endif
+            const normal_step& st = steps[normal_id];
+            v += offset;
+            uint64_t num = 0, den = 0;
+            uint axis = 0;
+            for (uint i = 0; i < d; i++) {
+                if (vn[i] == 0) continue;
+                uint64_t ni = vn[i] > 0 ? box[i] - v[i] : v[i];
+                if (den == 0 || ni * den < num * st.den[i]) {
+                    num = ni;
+                    den = st.den[i];
+                    axis = i;
+                }
+            }
+            const uint64_t recip = st.recip[axis];
+            for (uint i = 0; i < d; i++) {
+                // round(num * |vn[i]| / den), half away from zero
+                uint64_t x = 2 * num * st.den[i] + den;
+                uint64_t k = step_div(x >> 1, recip);
+                if (k * 2 * den == x) {
+                    k = std::round((double)num / (double)den * st.den[i]);
+                }
+                v[i] += vn[i] > 0 ? PosInt(k) : PosInt(-k);
+            }
+            assert(on_box(v));
+            const PosInt dist = distance_key(num, axis);
+#ifdef FSH_CHECK_PROJECTION
+            assert(v == expected && dist == expected_dist);
+#endif
+            return dist;
+        }
+        static uint64_t step_div(uint64_t x, uint64_t recip) {
+            return (x * recip) >> step_shift;
+        }
+        size_t find_surface(const point<d, PosInt>& v) const {
+            if constexpr (d == 3) {
+                // the highest axis sitting on its far face wins, otherwise
+                // the lowest axis sitting on its near face
+                uint hi = (v[0] == box[0]) | (v[1] == box[1]) << 1 |
+                          (v[2] == box[2]) << 2;
+                if (hi) {
+                    uint i = 31 - __builtin_clz(hi);
+                    return 2 * i + (v[i] != 0);
+                }
+                uint lo = (v[0] == 0) | (v[1] == 0) << 1 | (v[2] == 0) << 2;
+                assert(lo != 0);
+                return 2 * __builtin_ctz(lo);
+            }
             int ret = 0;
             for (uint i = 0; i < d; i++) {
                 bool ok = true;
@@ -312,43 +847,92 @@ namespace fsh {
             assert(ret != d * 2);
             return ret;
         }
-        constexpr size_t h(const point<d, PosInt>& v) const {
-            size_t surface_offset[d];
-            size_t surface_addr[2 * d];
-            size_t mul = 1;
+        // number of slots of a surface orthogonal to axis a when it is
+        // padded to whole tiles
+        size_t tiled_surface_size(uint a) const {
+            size_t sz = 1;
             for (uint i = 0; i < d; i++) {
-                mul *= (size_t)box[i];
+                if (i != a) sz *= tiled_extent(i) << tile_bits;
+            }
+            return sz;
+        }
+        size_t tiled_extent(uint i) const {
+            return ((size_t)box[i] >> tile_bits) + 1;
+        }
+        // caches where every surface starts in H and the row-major strides
+        // of the coordinates left on it, must be called whenever box changes
+        void update_layout() {
+            if (slot_layout == layout::morton) {
+                // strides of the tile coordinates, in slots
+                surface_addr[0] = 0;
+                for (uint i = 1; i < 2 * d; i++) {
+                    surface_addr[i] =
+                        surface_addr[i - 1] + tiled_surface_size((i - 1) / 2);
+                }
+                for (uint a = 0; a < d; a++) {
+                    size_t stride = size_t(1) << (tile_bits * (d - 1));
+                    for (uint j = 0; j < d; j++) {
+                        uint i = d - 1 - j;
+                        surface_stride[a][i] = i == a ? 0 : stride;
+                        if (i != a) stride *= tiled_extent(i);
+                    }
+                }
+                return;
             }
+            // coordinates on a surface run from 0 to box inclusive
+            size_t mul = 1;
             for (uint i = 0; i < d; i++) {
-                surface_offset[i] = mul / box[i];
+                mul *= (size_t)box[i] + 1;
             }
             surface_addr[0] = 0;
             for (uint i = 1; i < 2 * d; i++) {
                 surface_addr[i] =
-                    surface_addr[i - 1] + surface_offset[(i - 1) / 2];
+                    surface_addr[i - 1] + mul / ((size_t)box[(i - 1) / 2] + 1);
             }
+            for (uint a = 0; a < d; a++) {
+                size_t stride = 1;
+                for (uint j = 0; j < d; j++) {
+                    uint i = d - 1 - j;
+                    surface_stride[a][i] = i == a ? 0 : stride;
+                    if (i != a) stride *= (size_t)box[i] + 1;
+                }
+            }
+        }
+        size_t h(const point<d, PosInt>& v) const {
             size_t surface_id = find_surface(v);
+            const size_t* stride = surface_stride[surface_id / 2];
             size_t ret = surface_addr[surface_id];
-            point<d - 1, PosInt> p;
-            point<d - 1, PosInt> bound;
-            int cur = 0;
-            for (uint i = 0; i < d; i++) {
-                if (i != surface_id / 2) {
-                    p[cur] = v[i];
-                    bound[cur] = box[i];
-                    cur++;
+            if (slot_layout == layout::morton) {
+                // tile in row-major order, then z-order inside the tile
+                const uint axis = surface_id / 2;
+                const PosInt mask = (1 << tile_bits) - 1;
+                point<d - 1, uint> inner;
+                uint cur = 0;
+                for (uint i = 0; i < d; i++) {
+                    if (i == axis) continue;
+                    ret += (v[i] >> tile_bits) * stride[i];
+                    inner[cur++] = v[i] & mask;
+                }
+                return ret + morton_encode(inner);
+            }
+            if constexpr (d == 3) {
+                ret += v[0] * stride[0] + v[1] * stride[1] + v[2] * stride[2];
+            } else {
+                for (uint i = 0; i < d; i++) {
+                    ret += v[i] * stride[i];
                 }
             }
-            ret += point_to_index(p, bound, uint(-1));
             return ret;
         }
         bool create(const data_function& data) {
+            update_layout();
             // move to surface
             std::vector<data_t_large> suface_data(n);
             for (size_t i = 0; i < n; i++) {
                 data_t_large t = data(i);
-                t.normal = normals[get_normal_index(t.location)];
-                t.distance = move_to_box(t.location, t.normal);
+                size_t normal_id = get_normal_index(t.location);
+                t.normal = normals[normal_id];
+                t.distance = move_to_box(t.location, normal_id);
                 suface_data[i] = std::move(t);
             }
             // begin hash
@@ -361,7 +945,7 @@ namespace fsh {
                 assert(index < table_size);
                 if (H_hat[index].verify.empty()) {
                     H_hat[index].verify.add(it.normal, it.distance);
-                    H_hat[index].contents = it.contents;
+                    H_hat[index].value() = it.contents;
                 } else {
                     collision.push(it);
                 }
@@ -382,7 +966,7 @@ namespace fsh {
                     redirect_hat[index].redirect_table[verify] = i;
                     H_hat[i].verify = verify;
                     // H_hat[i].location = it.location;
-                    H_hat[i].contents = it.contents;
+                    H_hat[i].value() = it.contents;
                     H_hat[i].redirected = true;
                 }
             }
@@ -397,7 +981,7 @@ namespace fsh {
                 }
                 r.redirect.resize(r.k, 0);
                 for (const auto& it : r.redirect_table) {
-                    r.redirect[r.h(it.first)] = it.second;
+                    r.redirect[r.h(it.first)] = it.second + 1;
                 }
                 phi_hat.push_back(r);
                 H_hat[index].redirct_index = phi_hat.size();
@@ -410,7 +994,7 @@ namespace fsh {
         bool getK(const redirct_entry_large& r, HashInt& k) {
             std::set<HashInt> s;
             k = r.redirect_table.size();
-            assert(k >= 2);
+            assert(k >= 1);
             do {
                 k++;
                 if (k == 0) return false;
@@ -422,12 +1006,89 @@ namespace fsh {
             } while (s.size() != r.redirect_table.size());
             return true;
         }
-        size_t get_normal_index(const point<d, PosInt>& p) const {
-            bitset bit = normal_indices[0][p[0]];
-            for (uint i = 1; i < d; i++) {
-                bit &= normal_indices[i][p[i]];
+        // index in H of the entry with home slot home and verify data
+        // verify, size_t(-1) if there is none
+        size_t find_slot(size_t home, const entry_verify& verify) const {
+            const entry& en = H[home];
+            if (en.redirct_index == 0) {
+                return !en.redirected && en.equals(verify) ? home : size_t(-1);
+            }
+            const redirct_entry& re = phi[en.redirct_index - 1];
+            const size_t r = re.redirect[re.h(verify)];
+            return r != 0 && H[r - 1].equals(verify) ? r - 1 : size_t(-1);
+        }
+        size_t take_free_slot() {
+            while (!free_slots.empty()) {
+                const size_t i = free_slots.back();
+                free_slots.pop_back();
+                if (H[i].verify.empty()) return i;
+            }
+            for (; free_cursor < H.size(); free_cursor++) {
+                if (H[free_cursor].verify.empty()) return free_cursor++;
+            }
+            return size_t(-1);
+        }
+        // stores a new key with home slot home, false if it does not fit
+        bool place(size_t home, const entry_verify& verify,
+                   const T& contents) {
+            entry& en = H[home];
+            if (en.redirct_index == 0 && en.verify.empty()) {
+                en.verify = verify;
+                en.value() = contents;
+                en.redirected = false;
+                return true;
+            }
+            const size_t slot = en.verify.empty() ? home : take_free_slot();
+            if (slot == size_t(-1)) {
+                return false;
+            }
+            bool ok = true;
+            if (en.redirct_index != 0 &&
+                phi[en.redirct_index - 1].redirect[phi[en.redirct_index - 1]
+                                                       .h(verify)] == 0) {
+                // the bucket has room for it under its current k
+                redirct_entry& re = phi[en.redirct_index - 1];
+                re.redirect[re.h(verify)] = slot + 1;
+            } else {
+                // solve k again for the bucket with the new key in it
+                redirct_entry_large r(home);
+                if (en.redirct_index != 0) {
+                    for (size_t it : phi[en.redirct_index - 1].redirect) {
+                        if (it != 0) r.redirect_table[H[it - 1].verify] = it - 1;
+                    }
+                } else if (!en.redirected) {
+                    r.redirect_table[en.verify] = home;
+                }
+                r.redirect_table[verify] = slot;
+                ok = getK(r, r.k);
+                if (ok) {
+                    r.redirect.resize(r.k, 0);
+                    for (const auto& it : r.redirect_table) {
+                        r.redirect[r.h(it.first)] = it.second + 1;
+                    }
+                    if (en.redirct_index != 0) {
+                        phi[en.redirct_index - 1] = r;
+                    } else {
+                        phi.push_back(r);
+                        en.redirct_index = phi.size();
+                    }
+                }
+            }
+            if (!ok) {
+                if (slot != home) free_slots.push_back(slot);
+                return false;
+            }
+            H[slot].verify = verify;
+            H[slot].value() = contents;
+            H[slot].redirected = slot != home;
+            return true;
+        }
+        int get_normal_index(const point<d, PosInt>& p) const {
+            const bitset* rows[d];
+            for (uint i = 0; i < d; i++) {
+                rows[i] = &normal_indices[i][p[i]];
             }
-            return bit.find_fist();
+            return bitset::find_first_common(rows, d);
         }
     };
 }  // namespace fsh
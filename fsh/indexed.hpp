@@ -0,0 +1,117 @@
+#pragma once
+#ifndef FSH_INDEXED_HPP
+#define FSH_INDEXED_HPP
+
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "fsh.hpp"
+
+namespace fsh {
+    // an fsh::map for large contents. the entries of H hold the verify data
+    // and a 32 bit index into a dense array of contents, so empty slots
+    // cost 4 bytes of payload whatever T is and the contents can be
+    // scanned sequentially. with deduplicate set, byte-identical contents
+    // are stored once. T must be trivially copyable
+    template <uint d, class T, class PosInt, class NorInt, class HashInt>
+    class indexed_map {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "contents are compared and saved as bytes");
+
+    public:
+        using table_t = map<d, uint32_t, PosInt, NorInt, HashInt>;
+        using IndexInt = size_t;
+        using data_t = typename map<d, T, PosInt, NorInt, HashInt>::data_t;
+        using data_function = std::function<data_t(IndexInt)>;
+
+    private:
+        std::vector<T> payloads;
+        table_t table;
+
+        indexed_map(std::vector<T>&& payloads, table_t&& table)
+            : payloads(std::move(payloads)), table(std::move(table)) {}
+
+        // index of the contents of every element, filling payloads
+        std::vector<uint32_t> collect(const data_function& data, IndexInt n,
+                                      bool deduplicate) {
+            std::vector<uint32_t> ret(n);
+            // keys point into payloads, which must not reallocate meanwhile
+            payloads.reserve(n);
+            std::unordered_map<std::string_view, uint32_t> seen;
+            for (IndexInt i = 0; i < n; i++) {
+                payloads.push_back(data(i).contents);
+                ret[i] = payloads.size() - 1;
+                if (!deduplicate) continue;
+                std::string_view bytes(
+                    reinterpret_cast<const char*>(&payloads.back()),
+                    sizeof(T));
+                auto it = seen.emplace(bytes, ret[i]);
+                if (!it.second) {
+                    payloads.pop_back();
+                    ret[i] = it.first->second;
+                }
+            }
+            payloads.shrink_to_fit();
+            return ret;
+        }
+
+    public:
+        indexed_map(const data_function& data, IndexInt n,
+                    point<d, PosInt> box, bool deduplicate = false,
+                    layout slot_layout = layout::row_major,
+                    size_t max_normals = 0)
+            : table(
+                  [&, index = collect(data, n, deduplicate)](IndexInt i) {
+                      const data_t it = data(i);
+                      return typename table_t::data_t{it.location, it.normal,
+                                                      index[i]};
+                  },
+                  n, box, slot_layout, max_normals) {}
+
+        // returns nullptr when p is not in the map
+        const T* find(const point<d, PosInt>& p) const {
+            const uint32_t* index = table.find(p);
+            return index ? &payloads[*index] : nullptr;
+        }
+
+        const T& get(const point<d, PosInt>& p) const {
+            return payloads[table.get(p)];
+        }
+
+        // out[i] is set as find(ps[i]) would, see map::find_many
+        void find_many(const point<d, PosInt>* ps, size_t count,
+                       const T** out) const {
+            constexpr size_t chunk = 256;
+            const uint32_t* found[chunk];
+            for (size_t base = 0; base < count; base += chunk) {
+                const size_t m = std::min(chunk, count - base);
+                table.find_many(ps + base, m, found);
+                for (size_t i = 0; i < m; i++) {
+                    out[base + i] = found[i] ? &payloads[*found[i]] : nullptr;
+                }
+            }
+        }
+
+        // all stored contents, in the order they were first seen
+        const std::vector<T>& contents() const { return payloads; }
+
+        size_t memory_size() const {
+            return sizeof(*this) - sizeof(table) + table.memory_size() +
+                   sizeof(T) * payloads.capacity();
+        }
+
+        void save(std::ostream& out) const {
+            write_pod(out, payloads.size());
+            write_pod_array(out, payloads.data(), payloads.size());
+            table.save(out);
+        }
+        static indexed_map load(const char*& cursor) {
+            std::vector<T> payloads(read_pod<size_t>(cursor));
+            read_pod_array(cursor, payloads.data(), payloads.size());
+            return indexed_map(std::move(payloads), table_t::load(cursor));
+        }
+    };
+}  // namespace fsh
+
+#endif
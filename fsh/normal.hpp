@@ -0,0 +1,183 @@
+#pragma once
+#ifndef FSH_NORMAL_HPP
+#define FSH_NORMAL_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include "point.hpp"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace fsh {
+    // divides n by the gcd of its coordinates, so parallel normals become
+    // the same point
+    template <uint d, class NorInt>
+    point<d, NorInt> reduce_normal(point<d, NorInt> n) {
+        int g = 0;
+        for (uint i = 0; i < d; i++) {
+            g = std::gcd(g, std::abs(int(n[i])));
+        }
+        if (g > 1) {
+            for (uint i = 0; i < d; i++) {
+                n[i] /= g;
+            }
+        }
+        return n;
+    }
+
+    // rounds the unit vector v scaled by precision and reduces it, one
+    // normal per lattice direction
+    template <class NorInt>
+    point<3, NorInt> quantize_normal(const float* v, int precision) {
+        point<3, NorInt> n;
+        for (uint i = 0; i < 3; i++) {
+            n[i] = NorInt(std::lround(v[i] * precision));
+        }
+        return reduce_normal(n);
+    }
+
+    // turns unit vectors into integer normals for the map. directions are
+    // bucketed into cells x cells cells of an octahedral map of the sphere
+    // and every cell has one precomputed normal, quantize_normal of its
+    // center, so the number of distinct normals is at most cells * cells
+    // however many voxels there are. cells trades that count against how
+    // far a normal may point from its voxel's. it is precision / 4 unless
+    // given, so a coarser precision also means fewer normals: 100 gives
+    // 25 x 25 cells of about 7 degrees
+    template <class NorInt>
+    class normal_quantizer {
+        int cells;
+        std::vector<point<3, NorInt>> table;
+
+        // cell of the octahedral map of (x, y, z), any length but 0
+        static void encode(float x, float y, float z, float& u, float& v) {
+            const float sum = std::abs(x) + std::abs(y) + std::abs(z);
+            const float s = sum > 0 ? 1 / sum : 0;
+            x *= s;
+            y *= s;
+            // the lower half folds over the diagonals
+            const float fx = (1 - std::abs(y)) * (x >= 0 ? 1 : -1);
+            const float fy = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+            u = z < 0 ? fx : x;
+            v = z < 0 ? fy : y;
+        }
+        int cell(float u) const {
+            const int c = int((u + 1) * 0.5f * cells);
+            return c < 0 ? 0 : c >= cells ? cells - 1 : c;
+        }
+#ifdef __SSE2__
+        // encode() and cell() of four normals at once, lane for lane the
+        // same arithmetic, so the cells match the scalar ones exactly
+        void cells4(const float* v, uint32_t* index) const {
+            const __m128 x0 = _mm_setr_ps(v[0], v[3], v[6], v[9]);
+            const __m128 y0 = _mm_setr_ps(v[1], v[4], v[7], v[10]);
+            const __m128 z = _mm_setr_ps(v[2], v[5], v[8], v[11]);
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1);
+            const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+            auto abs = [&](__m128 a) { return _mm_and_ps(a, abs_mask); };
+            // mask ? a : b
+            auto select = [](__m128 mask, __m128 a, __m128 b) {
+                return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+            };
+            auto sign = [&](__m128 a) {
+                return select(_mm_cmpge_ps(a, zero), one, _mm_set1_ps(-1));
+            };
+
+            const __m128 sum = _mm_add_ps(_mm_add_ps(abs(x0), abs(y0)), abs(z));
+            const __m128 s = _mm_and_ps(_mm_cmpgt_ps(sum, zero),
+                                        _mm_div_ps(one, sum));
+            const __m128 x = _mm_mul_ps(x0, s);
+            const __m128 y = _mm_mul_ps(y0, s);
+            const __m128 fx = _mm_mul_ps(_mm_sub_ps(one, abs(y)), sign(x));
+            const __m128 fy = _mm_mul_ps(_mm_sub_ps(one, abs(x)), sign(y));
+            const __m128 lower = _mm_cmplt_ps(z, zero);
+            const __m128 u = select(lower, fx, x);
+            const __m128 w = select(lower, fy, y);
+
+            // clamping before the truncation gives cell()'s clamped result
+            const __m128 scale = _mm_set1_ps(float(cells));
+            const __m128 last = _mm_set1_ps(float(cells - 1));
+            auto to_cell = [&](__m128 a) {
+                a = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(a, one), _mm_set1_ps(0.5f)),
+                               scale);
+                return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(a, zero), last));
+            };
+            alignas(16) int32_t cu[4], cw[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(cu), to_cell(u));
+            _mm_store_si128(reinterpret_cast<__m128i*>(cw), to_cell(w));
+            for (int i = 0; i < 4; i++) {
+                index[i] = uint32_t(cu[i] * cells + cw[i]);
+            }
+        }
+#endif
+
+    public:
+        normal_quantizer(int precision, int ncells = 0)
+            : cells(ncells > 0 ? ncells : std::max(1, precision / 4)) {
+            if (precision < 1 || precision > std::numeric_limits<NorInt>::max()) {
+                throw std::invalid_argument("normal precision out of range");
+            }
+            table.resize(size_t(cells) * cells);
+            for (int i = 0; i < cells; i++) {
+                for (int j = 0; j < cells; j++) {
+                    float x = (i + 0.5f) / cells * 2 - 1;
+                    float y = (j + 0.5f) / cells * 2 - 1;
+                    float z = 1 - std::abs(x) - std::abs(y);
+                    if (z < 0) {
+                        const float fx = (1 - std::abs(y)) * (x >= 0 ? 1 : -1);
+                        y = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+                        x = fx;
+                    }
+                    const float len = std::sqrt(x * x + y * y + z * z);
+                    const float v[3] = {x / len, y / len, z / len};
+                    table[size_t(i) * cells + j] =
+                        quantize_normal<NorInt>(v, precision);
+                }
+            }
+        }
+
+        int cell_count() const { return cells; }
+
+        point<3, NorInt> operator()(const float* v) const {
+            float u, w;
+            encode(v[0], v[1], v[2], u, w);
+            return table[size_t(cell(u)) * cells + cell(w)];
+        }
+
+        // out[i] = (*this)(normals + 3 * i). the cells of a batch are found
+        // first, four at a time with SSE2, then looked up in the table
+        void operator()(const float* normals, size_t count,
+                        point<3, NorInt>* out) const {
+            constexpr size_t batch = 16;
+            uint32_t index[batch];
+            for (size_t base = 0; base < count; base += batch) {
+                const size_t m = std::min(batch, count - base);
+                const float* v = normals + 3 * base;
+                size_t i = 0;
+#ifdef __SSE2__
+                for (; i + 4 <= m; i += 4) {
+                    cells4(v + 3 * i, index + i);
+                }
+#endif
+                for (; i < m; i++) {
+                    float u, w;
+                    encode(v[3 * i], v[3 * i + 1], v[3 * i + 2], u, w);
+                    index[i] = uint32_t(cell(u) * cells + cell(w));
+                }
+                for (size_t i = 0; i < m; i++) {
+                    out[base + i] = table[index[i]];
+                }
+            }
+        }
+    };
+}  // namespace fsh
+
+#endif
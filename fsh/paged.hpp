@@ -0,0 +1,210 @@
+#pragma once
+#ifndef FSH_PAGED_HPP
+#define FSH_PAGED_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <fstream>
+#include <list>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include "sharded.hpp"
+
+namespace fsh {
+    // brick maps (see brick_builder) kept serialized in one file and paged
+    // in on demand. a missing brick is read with one pread, deserialized and
+    // put into an lru cache, and the least recently used bricks are dropped while
+    // the cache is over its memory budget. lookups update the cache, so a
+    // paged_map must not be shared between threads
+    template <uint d, class T, class NorInt, class HashInt,
+              uint brick_bits = 8>
+    class paged_map {
+    public:
+        using builder = brick_builder<d, T, NorInt, HashInt, brick_bits>;
+        using PosInt = typename builder::PosInt;
+        using IndexInt = typename builder::IndexInt;
+        using local_map = typename builder::local_map;
+        using data_t = typename builder::data_t;
+        using data_function = typename builder::data_function;
+        using brick_t = typename builder::brick_t;
+
+        struct stats {
+            size_t hits = 0;
+            size_t misses = 0;
+            size_t evictions = 0;
+            size_t resident_bricks = 0;
+            size_t resident_bytes = 0;
+        };
+
+    private:
+        // file layout: header, brick coordinates, brick offsets (count + 1
+        // of them, the last one is the file size), brick maps. version 2
+        // keys bricks by coordinate instead of a 64 bit morton code
+        static constexpr uint32_t magic = 0x50485346;  // "FSHP"
+        static constexpr uint32_t version = 2;
+        struct header {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t dimension;
+            uint32_t bits;
+            uint32_t contents_size;
+            uint64_t count;
+        };
+
+        struct slot {
+            std::unique_ptr<local_map> map;
+            std::list<size_t>::iterator pos;
+            size_t bytes;
+        };
+
+        // closes the file however the constructor or the map goes away
+        struct descriptor {
+            int fd = -1;
+            ~descriptor() {
+                if (fd >= 0) close(fd);
+            }
+        };
+
+        descriptor file;
+        size_t budget;
+        std::vector<brick_t> directory;
+        std::vector<uint64_t> offsets;
+        // most recently used brick first
+        std::list<size_t> lru;
+        std::unordered_map<size_t, slot> cache;
+        stats counters;
+
+        void read_at(void* out, size_t size, uint64_t at) const {
+            if (pread(file.fd, out, size, at) != ssize_t(size)) {
+                throw std::runtime_error("paged_map: truncated file");
+            }
+        }
+
+        // a brick map owns its tables, so the serialized brick is copied
+        // anyway and a plain read is all it takes
+        std::unique_ptr<local_map> load(size_t b) const {
+            std::vector<char> blob(offsets[b + 1] - offsets[b]);
+            read_at(blob.data(), blob.size(), offsets[b]);
+            const char* cursor = blob.data();
+            return std::make_unique<local_map>(local_map::load(cursor));
+        }
+
+        void evict() {
+            const size_t b = lru.back();
+            counters.resident_bytes -= cache.at(b).bytes;
+            counters.resident_bricks--;
+            counters.evictions++;
+            cache.erase(b);
+            lru.pop_back();
+        }
+
+    public:
+        // builds the brick maps of data and writes them to path. bricks
+        // are built in parallel, group of them at a time, so only about
+        // group brick maps are in memory at once
+        static void build(const std::string& path, const data_function& data,
+                          IndexInt n, size_t group = 64) {
+            builder b(data, n);
+            std::ofstream out(path, std::ios::binary);
+            if (!out) {
+                throw std::runtime_error("paged_map: cannot write " + path);
+            }
+            header h{magic, version, d, brick_bits, sizeof(T), b.size()};
+            write_pod(out, h);
+            write_pod_array(out, b.directory().data(), b.size());
+            const uint64_t offsets_at = out.tellp();
+            std::vector<uint64_t> offsets(b.size() + 1, 0);
+            write_pod_array(out, offsets.data(), offsets.size());
+
+            std::vector<std::string> blobs;
+            for (size_t base = 0; base < b.size(); base += group) {
+                const size_t m = std::min(group, b.size() - base);
+                blobs.assign(m, std::string());
+                tbb::parallel_for(size_t(0), m, [&](size_t i) {
+                    std::ostringstream blob;
+                    b.build(base + i)->save(blob);
+                    blobs[i] = blob.str();
+                });
+                for (size_t i = 0; i < m; i++) {
+                    offsets[base + i] = out.tellp();
+                    out.write(blobs[i].data(), blobs[i].size());
+                }
+            }
+            offsets[b.size()] = out.tellp();
+            out.seekp(offsets_at);
+            write_pod_array(out, offsets.data(), offsets.size());
+            if (!out) {
+                throw std::runtime_error("paged_map: cannot write " + path);
+            }
+        }
+
+        // opens a file written by build(), keeping at most memory_budget
+        // bytes of brick maps resident (but always the last one used)
+        paged_map(const std::string& path, size_t memory_budget)
+            : budget(memory_budget) {
+            file.fd = open(path.c_str(), O_RDONLY);
+            if (file.fd < 0) {
+                throw std::runtime_error("paged_map: cannot open " + path);
+            }
+            header h;
+            read_at(&h, sizeof(h), 0);
+            if (h.magic != magic || h.version != version || h.dimension != d ||
+                h.bits != brick_bits || h.contents_size != sizeof(T)) {
+                throw std::runtime_error("paged_map: incompatible file " +
+                                         path);
+            }
+            directory.resize(h.count);
+            offsets.resize(h.count + 1);
+            read_at(directory.data(), sizeof(brick_t) * directory.size(),
+                    sizeof(h));
+            read_at(offsets.data(), sizeof(uint64_t) * offsets.size(),
+                    sizeof(h) + sizeof(brick_t) * directory.size());
+        }
+        paged_map(const paged_map&) = delete;
+        paged_map& operator=(const paged_map&) = delete;
+
+        // returns nullptr when p is not in the map. the pointer stays valid
+        // until the brick holding it is evicted
+        const T* find(const point<d, PosInt>& p) {
+            const size_t b = builder::find_brick(directory, p);
+            if (b == size_t(-1)) {
+                return nullptr;
+            }
+            auto cached = cache.find(b);
+            if (cached != cache.end()) {
+                counters.hits++;
+                lru.splice(lru.begin(), lru, cached->second.pos);
+                return cached->second.map->find(builder::local_point(p));
+            }
+            counters.misses++;
+            std::unique_ptr<local_map> m = load(b);
+            const size_t bytes = m->memory_size();
+            while (!lru.empty() && counters.resident_bytes + bytes > budget) {
+                evict();
+            }
+            lru.push_front(b);
+            slot& s = cache[b];
+            s.map = std::move(m);
+            s.pos = lru.begin();
+            s.bytes = bytes;
+            counters.resident_bytes += bytes;
+            counters.resident_bricks++;
+            return s.map->find(builder::local_point(p));
+        }
+
+        const T& get(const point<d, PosInt>& p) {
+            const T* ret = find(p);
+            if (ret == nullptr) {
+                NOT_FOUND_EXCEPTION();
+            }
+            return *ret;
+        }
+
+        size_t brick_count() const { return directory.size(); }
+        const stats& statistics() const { return counters; }
+    };
+}  // namespace fsh
+
+#endif
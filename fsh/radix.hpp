@@ -0,0 +1,106 @@
+#pragma once
+#ifndef FSH_RADIX_HPP
+#define FSH_RADIX_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#include "point.hpp"
+
+namespace fsh {
+    // packs p into one 64 bit key, p[0] in the highest bits, so keys compare
+    // like the points do. bits is the width of each coordinate, d * bits
+    // must fit in 64
+    template <uint d, class Int>
+    uint64_t pack_location(const point<d, Int>& p, uint bits) {
+        uint64_t key = 0;
+        for (uint i = 0; i < d; i++) {
+            key = key << bits | uint64_t(p[i]);
+        }
+        return key;
+    }
+
+    namespace radix_helpers {
+        constexpr uint digit_bits = 8;
+        constexpr size_t radix = size_t(1) << digit_bits;
+    }  // namespace radix_helpers
+
+    // stable LSD radix sort of items by key(item), a uint64_t of which only
+    // the lowest key_bits are looked at. each pass of 8 bits splits the
+    // items in nblock contiguous blocks, one per core by default: tbb tasks
+    // count the blocks, the counts are summed into (digit, block) offsets
+    // and every block is scattered by a task of its own. passes where all
+    // items share a digit are skipped
+    template <class T, class Key>
+    void radix_sort(std::vector<T>& items, const Key& key, uint key_bits = 64,
+                    size_t nblock = 0) {
+        using namespace radix_helpers;
+        const size_t n = items.size();
+        if (nblock == 0) {
+            nblock = tbb::this_task_arena::max_concurrency();
+        }
+        // small blocks are not worth a task
+        nblock = std::max<size_t>(1, std::min(nblock, n / 4096));
+        const size_t block = (n + nblock - 1) / nblock;
+
+        std::vector<T> scratch(n);
+        std::vector<size_t> counts(nblock * radix);
+        for (uint shift = 0; shift < key_bits; shift += digit_bits) {
+            auto digit = [&](const T& it) {
+                return size_t(key(it) >> shift) & (radix - 1);
+            };
+            std::fill(counts.begin(), counts.end(), 0);
+            tbb::parallel_for(size_t(0), nblock, [&](size_t t) {
+                size_t* count = &counts[t * radix];
+                const size_t end = std::min(n, (t + 1) * block);
+                for (size_t i = t * block; i < end; i++) {
+                    count[digit(items[i])]++;
+                }
+            });
+
+            // exclusive prefix over digits first, then blocks, keeps the
+            // blocks in order within a digit
+            size_t sum = 0;
+            bool trivial = false;
+            for (size_t r = 0; r < radix; r++) {
+                size_t total = 0;
+                for (size_t t = 0; t < nblock; t++) {
+                    const size_t c = counts[t * radix + r];
+                    counts[t * radix + r] = sum;
+                    sum += c;
+                    total += c;
+                }
+                trivial |= total == n;
+            }
+            if (trivial) continue;
+
+            tbb::parallel_for(size_t(0), nblock, [&](size_t t) {
+                size_t* offset = &counts[t * radix];
+                const size_t end = std::min(n, (t + 1) * block);
+                for (size_t i = t * block; i < end; i++) {
+                    scratch[offset[digit(items[i])]++] = items[i];
+                }
+            });
+            items.swap(scratch);
+        }
+    }
+
+    // radix_sort, then drops every item whose key equals the one before, so
+    // of equal keys the first in the input stays
+    template <class T, class Key>
+    void radix_sort_unique(std::vector<T>& items, const Key& key,
+                           uint key_bits = 64, size_t nblock = 0) {
+        radix_sort(items, key, key_bits, nblock);
+        size_t out = 0;
+        for (size_t i = 0; i < items.size(); i++) {
+            if (out == 0 || key(items[i]) != key(items[out - 1])) {
+                items[out++] = items[i];
+            }
+        }
+        items.erase(items.begin() + out, items.end());
+    }
+}  // namespace fsh
+
+#endif
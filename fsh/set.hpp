@@ -0,0 +1,79 @@
+#pragma once
+#ifndef FSH_SET_HPP
+#define FSH_SET_HPP
+
+#include "fsh.hpp"
+
+namespace fsh {
+    // contents of a set entry, takes no space in H (see payload)
+    struct none {};
+
+    // an fsh::map that only knows which points are in it, for occupancy
+    // grids. entries hold the verify data and nothing else
+    template <uint d, class PosInt, class NorInt, class HashInt>
+    class set {
+    public:
+        using table_t = map<d, none, PosInt, NorInt, HashInt>;
+        using IndexInt = size_t;
+
+        struct data_t {
+            point<d, PosInt> location;
+            point<d, NorInt> normal;
+        };
+        using data_function = std::function<data_t(IndexInt)>;
+
+    private:
+        table_t table;
+
+        explicit set(table_t&& table) : table(std::move(table)) {}
+
+    public:
+        set(const data_function& data, IndexInt n, point<d, PosInt> box,
+            layout slot_layout = layout::row_major, size_t max_normals = 0)
+            : table(
+                  [&](IndexInt i) {
+                      const data_t it = data(i);
+                      return typename table_t::data_t{it.location, it.normal,
+                                                      none{}};
+                  },
+                  n, box, slot_layout, max_normals) {}
+
+        bool contains(const point<d, PosInt>& p) const {
+            return table.find(p) != nullptr;
+        }
+
+        // out[i] is set as contains(ps[i]) would, see map::find_many
+        void contains_many(const point<d, PosInt>* ps, size_t count,
+                           bool* out) const {
+            constexpr size_t chunk = 256;
+            const none* found[chunk];
+            for (size_t base = 0; base < count; base += chunk) {
+                const size_t m = std::min(chunk, count - base);
+                table.find_many(ps + base, m, found);
+                for (size_t i = 0; i < m; i++) {
+                    out[base + i] = found[i] != nullptr;
+                }
+            }
+        }
+
+        // returns whether p is new, see map::insert
+        bool insert(const data_t& it) {
+            return table.insert({it.location, it.normal, none{}});
+        }
+        bool erase(const point<d, PosInt>& p) { return table.erase(p); }
+
+        size_t overflow_size() const { return table.overflow_size(); }
+        size_t normal_count() const { return table.normal_count(); }
+        size_t normal_index_bits() const { return table.normal_index_bits(); }
+        size_t memory_size() const {
+            return table.memory_size() - sizeof(table) + sizeof(*this);
+        }
+
+        void save(std::ostream& out) const { table.save(out); }
+        static set load(const char*& cursor) {
+            return set(table_t::load(cursor));
+        }
+    };
+}  // namespace fsh
+
+#endif
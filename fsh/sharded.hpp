@@ -0,0 +1,191 @@
+#pragma once
+#ifndef FSH_SHARDED_HPP
+#define FSH_SHARDED_HPP
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <tbb/parallel_for.h>
+#include "fsh.hpp"
+
+namespace fsh {
+    // cuts space into bricks of 2^brick_bits cells per axis and builds the
+    // fsh::map of a single brick on demand. locations are 32 bit, a brick
+    // map only sees 16 bit coordinates relative to its brick
+    template <uint d, class T, class NorInt, class HashInt, uint brick_bits>
+    class brick_builder {
+        // leaves the brick maps room to grow their box
+        static_assert(brick_bits <= 14, "bricks must fit 16 bit maps");
+
+    public:
+        using PosInt = uint32_t;
+        using LocalInt = uint16_t;
+        using IndexInt = size_t;
+        using local_map = map<d, T, LocalInt, NorInt, HashInt>;
+
+        struct data_t {
+            point<d, PosInt> location;
+            point<d, NorInt> normal;
+            T contents;
+        };
+        using data_function = std::function<data_t(IndexInt)>;
+
+        static constexpr PosInt brick_mask = (PosInt(1) << brick_bits) - 1;
+
+        // bricks are identified by their full brick coordinate, a morton
+        // code of d * (32 - brick_bits) bits would not fit 64
+        using brick_t = point<d, PosInt>;
+        static brick_t brick_key(const point<d, PosInt>& p) {
+            brick_t b;
+            for (uint i = 0; i < d; i++) {
+                b[i] = p[i] >> brick_bits;
+            }
+            return b;
+        }
+        // morton order of brick coordinates without encoding them: the axis
+        // whose coordinates differ in the highest bit decides, the lower
+        // axis on a tie, as in morton_encode
+        static bool brick_less(const brick_t& lhs, const brick_t& rhs) {
+            uint axis = 0;
+            PosInt top = lhs[0] ^ rhs[0];
+            for (uint i = 1; i < d; i++) {
+                const PosInt diff = lhs[i] ^ rhs[i];
+                if (top < diff && top < (top ^ diff)) {
+                    axis = i;
+                    top = diff;
+                }
+            }
+            return lhs[axis] < rhs[axis];
+        }
+        // index in directory of the brick of p, size_t(-1) if it is empty
+        static size_t find_brick(const std::vector<brick_t>& directory,
+                                 const point<d, PosInt>& p) {
+            const brick_t key = brick_key(p);
+            auto it = std::lower_bound(directory.begin(), directory.end(), key,
+                                       brick_less);
+            if (it == directory.end() || *it != key) {
+                return size_t(-1);
+            }
+            return it - directory.begin();
+        }
+        static point<d, LocalInt> local_point(const point<d, PosInt>& p) {
+            point<d, LocalInt> ret;
+            for (uint i = 0; i < d; i++) {
+                ret[i] = p[i] & brick_mask;
+            }
+            return ret;
+        }
+
+    private:
+        const data_function& data;
+        // element indices sorted by brick key
+        std::vector<std::pair<brick_t, IndexInt>> keys;
+        // sorted keys of the non-empty bricks and where they start in keys
+        std::vector<brick_t> brick_keys;
+        std::vector<IndexInt> first;
+
+    public:
+        brick_builder(const data_function& data, IndexInt n)
+            : data(data), keys(n) {
+            tbb::parallel_for(IndexInt(0), n, [&](IndexInt i) {
+                keys[i] = {brick_key(data(i).location), i};
+            });
+            std::sort(keys.begin(), keys.end(),
+                      [](const std::pair<brick_t, IndexInt>& lhs,
+                         const std::pair<brick_t, IndexInt>& rhs) {
+                          return brick_less(lhs.first, rhs.first) ||
+                                 (lhs.first == rhs.first &&
+                                  lhs.second < rhs.second);
+                      });
+            for (IndexInt i = 0; i < n; i++) {
+                if (i == 0 || keys[i].first != keys[i - 1].first) {
+                    brick_keys.push_back(keys[i].first);
+                    first.push_back(i);
+                }
+            }
+            first.push_back(n);
+        }
+
+        size_t size() const { return brick_keys.size(); }
+        const std::vector<brick_t>& directory() const { return brick_keys; }
+
+        std::unique_ptr<local_map> build(size_t b) const {
+            const IndexInt begin = first[b];
+            const IndexInt count = first[b + 1] - begin;
+            auto local = [&](IndexInt i) {
+                const data_t& it = data(keys[begin + i].second);
+                return typename local_map::data_t{local_point(it.location),
+                                                  it.normal, it.contents};
+            };
+            // a flat brick still needs a non-degenerate box
+            point<d, LocalInt> box = point<d, LocalInt>::repeating(1);
+            for (IndexInt i = 0; i < count; i++) {
+                const point<d, LocalInt> p = local(i).location;
+                for (uint j = 0; j < d; j++) {
+                    box[j] = std::max(box[j], p[j]);
+                }
+            }
+            return std::make_unique<local_map>(local, count, box);
+        }
+    };
+
+    // keeps one fsh::map per non-empty brick of space, see brick_builder.
+    // the brick maps are built in parallel
+    template <uint d, class T, class NorInt, class HashInt,
+              uint brick_bits = 8>
+    class sharded_map {
+    public:
+        using builder = brick_builder<d, T, NorInt, HashInt, brick_bits>;
+        using PosInt = typename builder::PosInt;
+        using IndexInt = typename builder::IndexInt;
+        using local_map = typename builder::local_map;
+        using data_t = typename builder::data_t;
+        using data_function = typename builder::data_function;
+
+    private:
+        // coordinates of the non-empty bricks in morton order, and their
+        // maps
+        std::vector<typename builder::brick_t> directory;
+        std::vector<std::unique_ptr<local_map>> bricks;
+
+    public:
+        sharded_map(const data_function& data, IndexInt n) {
+            builder b(data, n);
+            directory = b.directory();
+            bricks.resize(b.size());
+            tbb::parallel_for(size_t(0), b.size(),
+                              [&](size_t i) { bricks[i] = b.build(i); });
+        }
+
+        // returns nullptr when p is not in the map
+        const T* find(const point<d, PosInt>& p) const {
+            const size_t b = builder::find_brick(directory, p);
+            if (b == size_t(-1)) {
+                return nullptr;
+            }
+            return bricks[b]->find(builder::local_point(p));
+        }
+
+        const T& get(const point<d, PosInt>& p) const {
+            const T* ret = find(p);
+            if (ret == nullptr) {
+                NOT_FOUND_EXCEPTION();
+            }
+            return *ret;
+        }
+
+        size_t brick_count() const { return bricks.size(); }
+
+        size_t memory_size() const {
+            size_t ret = sizeof(*this);
+            ret += sizeof(typename decltype(directory)::value_type) *
+                   directory.capacity();
+            for (const auto& it : bricks) {
+                ret += sizeof(it) + it->memory_size();
+            }
+            return ret;
+        }
+    };
+}  // namespace fsh
+
+#endif
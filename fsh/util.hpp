@@ -4,8 +4,23 @@
 #define FSH_UTIL_HPP
 
 #include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
 #include "point.hpp"
 #include <iostream>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+// hints the cache to fetch the line holding addr ahead of a dependent read
+#if defined(__GNUC__) || defined(__clang__)
+#define FSH_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define FSH_PREFETCH(addr) ((void)(addr))
+#endif
+
 namespace fsh {
     namespace {
         // these functions convert between multidimensional (points) and linear
@@ -108,6 +123,321 @@ namespace fsh {
         return point<d, IntS>(point_helpers<d, IntL>::index_to_point(
             index, point<d, IntL>(bouding), max));
     }
+
+    // flat binary (de)serialization of trivially copyable values, readers
+    // advance the cursor past what they read
+    template <class V>
+    void write_pod(std::ostream& out, const V& v) {
+        static_assert(std::is_trivially_copyable<V>::value,
+                      "V must be trivially copyable");
+        out.write(reinterpret_cast<const char*>(&v), sizeof(V));
+    }
+    template <class V>
+    void write_pod_array(std::ostream& out, const V* v, size_t count) {
+        static_assert(std::is_trivially_copyable<V>::value,
+                      "V must be trivially copyable");
+        out.write(reinterpret_cast<const char*>(v), sizeof(V) * count);
+    }
+    template <class V>
+    V read_pod(const char*& cursor) {
+        V v;
+        std::memcpy(&v, cursor, sizeof(V));
+        cursor += sizeof(V);
+        return v;
+    }
+    template <class V>
+    void read_pod_array(const char*& cursor, V* v, size_t count) {
+        std::memcpy(v, cursor, sizeof(V) * count);
+        cursor += sizeof(V) * count;
+    }
+
+    // z-order (morton) codes: bit j of p[i] goes to bit j * d + (d - 1 - i)
+    // of the code, so like point_to_index the last axis varies fastest.
+    // 64 / d bits per axis are kept
+    template <uint d>
+    constexpr uint64_t morton_mask(uint i) {
+        uint64_t mask = 0;
+        for (uint j = 0; j * d + (d - 1 - i) < 64; j++) {
+            mask |= uint64_t(1) << (j * d + (d - 1 - i));
+        }
+        return mask;
+    }
+
+    namespace {
+        template <uint d>
+        struct morton_helpers {
+            static constexpr uint64_t spread(uint64_t x) {
+                uint64_t ret = 0;
+                for (uint j = 0; j * d < 64; j++) {
+                    ret |= ((x >> j) & 1) << (j * d);
+                }
+                return ret;
+            }
+            static constexpr uint64_t compact(uint64_t x) {
+                uint64_t ret = 0;
+                for (uint j = 0; j * d < 64; j++) {
+                    ret |= ((x >> (j * d)) & 1) << j;
+                }
+                return ret;
+            }
+        };
+
+        template <>
+        struct morton_helpers<2> {
+            static constexpr uint64_t spread(uint64_t x) {
+                x &= 0xffffffff;
+                x = (x | x << 16) & 0x0000ffff0000ffff;
+                x = (x | x << 8) & 0x00ff00ff00ff00ff;
+                x = (x | x << 4) & 0x0f0f0f0f0f0f0f0f;
+                x = (x | x << 2) & 0x3333333333333333;
+                x = (x | x << 1) & 0x5555555555555555;
+                return x;
+            }
+            static constexpr uint64_t compact(uint64_t x) {
+                x &= 0x5555555555555555;
+                x = (x | x >> 1) & 0x3333333333333333;
+                x = (x | x >> 2) & 0x0f0f0f0f0f0f0f0f;
+                x = (x | x >> 4) & 0x00ff00ff00ff00ff;
+                x = (x | x >> 8) & 0x0000ffff0000ffff;
+                x = (x | x >> 16) & 0x00000000ffffffff;
+                return x;
+            }
+        };
+
+        template <>
+        struct morton_helpers<3> {
+            static constexpr uint64_t spread(uint64_t x) {
+                x &= 0x1fffff;
+                x = (x | x << 32) & 0x001f00000000ffff;
+                x = (x | x << 16) & 0x001f0000ff0000ff;
+                x = (x | x << 8) & 0x100f00f00f00f00f;
+                x = (x | x << 4) & 0x10c30c30c30c30c3;
+                x = (x | x << 2) & 0x1249249249249249;
+                return x;
+            }
+            static constexpr uint64_t compact(uint64_t x) {
+                x &= 0x1249249249249249;
+                x = (x | x >> 2) & 0x10c30c30c30c30c3;
+                x = (x | x >> 4) & 0x100f00f00f00f00f;
+                x = (x | x >> 8) & 0x001f0000ff0000ff;
+                x = (x | x >> 16) & 0x001f00000000ffff;
+                x = (x | x >> 32) & 0x00000000001fffff;
+                return x;
+            }
+        };
+    }  // namespace
+
+    template <uint d, class Int>
+    inline uint64_t morton_encode(const point<d, Int>& p) {
+        uint64_t code = 0;
+        for (uint i = 0; i < d; i++) {
+#ifdef __BMI2__
+            code |= _pdep_u64(uint64_t(p[i]), morton_mask<d>(i));
+#else
+            code |= morton_helpers<d>::spread(uint64_t(p[i])) << (d - 1 - i);
+#endif
+        }
+        return code;
+    }
+
+    template <uint d, class Int>
+    inline point<d, Int> morton_decode(uint64_t code) {
+        point<d, Int> p;
+        for (uint i = 0; i < d; i++) {
+#ifdef __BMI2__
+            p[i] = Int(_pext_u64(code, morton_mask<d>(i)));
+#else
+            p[i] = Int(morton_helpers<d>::compact(code >> (d - 1 - i)));
+#endif
+        }
+        return p;
+    }
+
+    // walks the points of the box [0, bounding) whose linear index lies in
+    // [begin, end), in the order of index_to_point. only begin is decoded,
+    // every step after that is a carry update, and disjoint index ranges
+    // can be walked by different threads
+    template <uint d, class Int>
+    class grid_cursor {
+    private:
+        point<d, Int> bounding;
+        point<d, Int> p;
+        uint64_t cur;
+        uint64_t end;
+
+    public:
+        grid_cursor(const point<d, Int>& bounding, uint64_t begin,
+                    uint64_t end)
+            : bounding(bounding), cur(begin), end(end) {
+            if (cur < end) {
+                p = index_to_point<d>(cur, bounding, uint64_t(-1));
+            }
+        }
+        explicit grid_cursor(const point<d, Int>& bounding)
+            : grid_cursor(bounding, 0, size(bounding)) {}
+
+        static uint64_t size(const point<d, Int>& bounding) {
+            uint64_t ret = 1;
+            for (uint i = 0; i < d; i++) {
+                ret *= bounding[i];
+            }
+            return ret;
+        }
+
+        bool valid() const { return cur < end; }
+        uint64_t index() const { return cur; }
+        const point<d, Int>& operator*() const { return p; }
+
+        grid_cursor& operator++() {
+            cur++;
+            for (uint j = 0; j < d; j++) {
+                uint i = d - 1 - j;
+                if (++p[i] < bounding[i]) break;
+                p[i] = 0;
+            }
+            return *this;
+        }
+    };
+
+    // walks the points of the box [0, bounding) in z-order. the codes of a
+    // power-of-two cube around the box are enumerated and runs of codes
+    // outside the box are jumped over with bigmin (tropf & herzog, 1981).
+    // [begin, end) is a range of codes, code_end(bounding) closes the last
+    template <uint d, class Int>
+    class morton_cursor {
+    private:
+        uint64_t zmax;
+        point<d, Int> p;
+        uint64_t cur;
+        uint64_t end;
+
+        bool inside(uint64_t code) const {
+            for (uint i = 0; i < d; i++) {
+                if ((code & morton_mask<d>(i)) > (zmax & morton_mask<d>(i))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // smallest code > code that lies inside the box
+        uint64_t bigmin(uint64_t code) const {
+            uint64_t lo = 0, hi = zmax, ret = end;
+            for (uint b = 0; b < 64; b++) {
+                uint bit = 63 - b;
+                uint64_t m = uint64_t(1) << bit;
+                // bits of the same axis below this one
+                uint64_t below = morton_mask<d>(d - 1 - bit % d) & (m - 1);
+                bool v = code & m, mn = lo & m, mx = hi & m;
+                if (!v && !mn && mx) {
+                    ret = (lo & ~below) | m;
+                    hi = (hi & ~m) | below;
+                } else if (!v && mn && mx) {
+                    return lo;
+                } else if (v && !mn && !mx) {
+                    return ret;
+                } else if (v && !mn && mx) {
+                    lo = (lo & ~below) | m;
+                }
+            }
+            return ret;
+        }
+
+        void settle() {
+            if (cur < end && !inside(cur)) cur = bigmin(cur);
+            if (cur < end) p = morton_decode<d, Int>(cur);
+        }
+
+    public:
+        morton_cursor(const point<d, Int>& bounding, uint64_t begin,
+                      uint64_t end)
+            : zmax(code_end(bounding) - 1),
+              cur(begin),
+              end(std::min(end, zmax + 1)) {
+            settle();
+        }
+        explicit morton_cursor(const point<d, Int>& bounding)
+            : morton_cursor(bounding, 0, code_end(bounding)) {}
+
+        static uint64_t code_end(const point<d, Int>& bounding) {
+            point<d, Int> last;
+            for (uint i = 0; i < d; i++) {
+                last[i] = bounding[i] - 1;
+            }
+            return morton_encode(last) + 1;
+        }
+
+        bool valid() const { return cur < end; }
+        uint64_t code() const { return cur; }
+        const point<d, Int>& operator*() const { return p; }
+
+        morton_cursor& operator++() {
+            cur++;
+            settle();
+            return *this;
+        }
+    };
+
+    // hilbert curve index of p on a grid of 2^bits cells per axis, with
+    // d * bits <= 64. uses skilling's transpose form ("programming the
+    // hilbert curve", 2004), whose interleaving is the hilbert index
+    template <uint d, class Int>
+    inline uint64_t hilbert_encode(const point<d, Int>& p, uint bits) {
+        uint64_t x[d];
+        for (uint i = 0; i < d; i++) {
+            x[i] = uint64_t(p[i]);
+        }
+        const uint64_t m = uint64_t(1) << (bits - 1);
+        for (uint64_t q = m; q > 1; q >>= 1) {
+            const uint64_t mask = q - 1;
+            for (uint i = 0; i < d; i++) {
+                if (x[i] & q) {
+                    x[0] ^= mask;
+                } else {
+                    uint64_t t = (x[0] ^ x[i]) & mask;
+                    x[0] ^= t;
+                    x[i] ^= t;
+                }
+            }
+        }
+        for (uint i = 1; i < d; i++) {
+            x[i] ^= x[i - 1];
+        }
+        uint64_t t = 0;
+        for (uint64_t q = m; q > 1; q >>= 1) {
+            if (x[d - 1] & q) t ^= q - 1;
+        }
+        point<d, uint64_t> transposed;
+        for (uint i = 0; i < d; i++) {
+            transposed[i] = x[i] ^ t;
+        }
+        return morton_encode(transposed);
+    }
+
+    template <uint d, class Int>
+    inline point<d, Int> hilbert_decode(uint64_t code, uint bits) {
+        point<d, uint64_t> x = morton_decode<d, uint64_t>(code);
+        const uint64_t n = uint64_t(2) << (bits - 1);
+        uint64_t t = x[d - 1] >> 1;
+        for (uint i = d - 1; i > 0; i--) {
+            x[i] ^= x[i - 1];
+        }
+        x[0] ^= t;
+        for (uint64_t q = 2; q != n; q <<= 1) {
+            const uint64_t mask = q - 1;
+            for (uint j = 0; j < d; j++) {
+                uint i = d - 1 - j;
+                if (x[i] & q) {
+                    x[0] ^= mask;
+                } else {
+                    t = (x[0] ^ x[i]) & mask;
+                    x[0] ^= t;
+                    x[i] ^= t;
+                }
+            }
+        }
+        return point<d, Int>(x);
+    }
 }  // namespace fsh
 
 #endif
\ No newline at end of file
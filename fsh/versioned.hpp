@@ -0,0 +1,96 @@
+#pragma once
+#ifndef FSH_VERSIONED_HPP
+#define FSH_VERSIONED_HPP
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+
+namespace fsh {
+    // holds the current version of an immutable map (fsh::map, sharded_map)
+    // and swaps in new versions without stopping readers. a reader pins a
+    // snapshot with acquire() and keeps using it for as long as it likes,
+    // the version it pinned is freed when the last snapshot of it is gone.
+    // rebuild() builds the next version on a background thread while the
+    // current one keeps serving lookups, then publishes it atomically
+    template <class Map>
+    class versioned {
+    public:
+        using snapshot = std::shared_ptr<const Map>;
+        using build_function = std::function<snapshot()>;
+
+    private:
+        // only touched through the std::atomic_* shared_ptr overloads
+        snapshot current;
+        std::atomic<uint64_t> number;
+        std::atomic<bool> busy;
+        // serializes writers, readers never take it
+        std::mutex writer;
+        std::future<void> pending;
+
+        // clears busy however the rebuild ends
+        struct finish {
+            std::atomic<bool>& flag;
+            ~finish() { flag.store(false, std::memory_order_release); }
+        };
+
+    public:
+        explicit versioned(snapshot initial)
+            : current(std::move(initial)), number(0), busy(false) {}
+        versioned(const versioned&) = delete;
+        versioned& operator=(const versioned&) = delete;
+        // waits for a rebuild still in flight
+        ~versioned() {
+            if (pending.valid()) {
+                pending.wait();
+            }
+        }
+
+        // the current version, valid for as long as the snapshot is held
+        snapshot acquire() const { return std::atomic_load(&current); }
+
+        // how many versions were published after the initial one
+        uint64_t version() const {
+            return number.load(std::memory_order_acquire);
+        }
+
+        // makes next the current version, readers holding an older
+        // snapshot keep it until they drop it
+        void publish(snapshot next) {
+            std::atomic_store(&current, std::move(next));
+            number.fetch_add(1, std::memory_order_release);
+        }
+
+        // runs build on a background thread and publishes its result. a
+        // rebuild still in flight is finished first, so versions are
+        // published in the order their rebuilds were started. when build
+        // throws nothing is published and the next wait() or rebuild()
+        // rethrows the exception
+        void rebuild(build_function build) {
+            std::lock_guard<std::mutex> lock(writer);
+            if (pending.valid()) {
+                pending.get();
+            }
+            busy.store(true, std::memory_order_release);
+            pending = std::async(std::launch::async,
+                                 [this, build = std::move(build)]() {
+                                     finish guard{busy};
+                                     publish(build());
+                                 });
+        }
+
+        bool rebuilding() const { return busy.load(std::memory_order_acquire); }
+
+        // blocks until the last rebuild is published
+        void wait() {
+            std::lock_guard<std::mutex> lock(writer);
+            if (pending.valid()) {
+                pending.get();
+            }
+        }
+    };
+}  // namespace fsh
+
+#endif
@@ -17,9 +17,11 @@ using namespace glm;
 #include "common/texture.hpp"
 #include "common/controls.hpp"
 #include "common/objloader.hpp"
+#include "common/vboindexer.hpp"
 
 #include "voxelizer.h"
 #include "tiny_obj_loader.h"
+#include "mesh_cache.h"
 #include <iostream>
 #include <functional>
 #include <algorithm>
@@ -28,73 +30,210 @@ using namespace glm;
 #include <chrono>
 #include <stdint.h>
 #include <thread>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/global_control.h>
+#include <random>
+#include <numeric>
+#include <memory>
+#include <sstream>
 
-#include <set>
 #include <cassert>
 
 #include "fsh/fsh.hpp"
+#include "fsh/set.hpp"
+#include "fsh/indexed.hpp"
+#include "fsh/color.hpp"
+#include "fsh/versioned.hpp"
+#include "fsh/dynamic.hpp"
+#include "fsh/sharded.hpp"
+#include "fsh/paged.hpp"
+#include "fsh/radix.hpp"
+#include "fsh/normal.hpp"
 
 using std::cout, std::endl;
 
 int main(int argc, char** argv) {
+    // usage: fsh [--headless] [model.obj...]
+    // the first model is voxelized. headless runs everything but the
+    // window, for timing ingest, and benchmarks the obj loaders on every
+    // model given
+    bool headless = false;
+    std::vector<std::string> models;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--headless") {
+            headless = true;
+        } else {
+            models.push_back(argv[i]);
+        }
+    }
+    if (models.empty()) {
+        models.push_back("models/bunny.obj");
+    }
+    const std::string& model = models[0];
+
+    // meshes to voxelize, mapped from the mesh cache of the model while it
+    // is current, else viewed in place in the parsed shapes and written to
+    // the cache
+    mesh_cache cache;
     std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string err;
-    bool ret =
-        tinyobj::LoadObj(shapes, materials, err, "models/bunny.obj", NULL);
+    // per vertex r, g, b of each shape
+    std::vector<std::vector<float>> shape_colors;
+    std::vector<vx_mesh_view_t> meshes;
+    auto load_start = std::chrono::high_resolution_clock::now();
 
-    if (!err.empty()) {
-        std::cerr << err << std::endl;
-    }
+    if (cache.open(model)) {
+        for (size_t i = 0; i < cache.size(); i++) {
+            meshes.push_back(cache.mesh(i));
+        }
+    } else {
+        std::vector<tinyobj::material_t> materials;
+        std::string err;
+        bool ret = tinyobj::LoadObjMapped(shapes, materials, err,
+                                          model.c_str(), NULL);
+
+        if (!err.empty()) {
+            std::cerr << err << std::endl;
+        }
+
+        if (!ret) {
+            return EXIT_FAILURE;
+        }
+
+        shape_colors.resize(shapes.size());
+        for (size_t i = 0; i < shapes.size(); i++) {
+            const tinyobj::mesh_t& shape = shapes[i].mesh;
+            const std::vector<float>& positions = shape.positions;
+            const size_t nvertex = positions.size() / 3;
+            std::vector<float>& colors = shape_colors[i];
+            colors.assign(positions.size(), 0.0f);
 
-    if (!ret) {
-        return EXIT_FAILURE;
+            // vertices take the diffuse color of their face's material, or a
+            // color gradient over the bounding box of the shape when the
+            // face has none
+            if (nvertex > 0) {
+                float lo[3], hi[3];
+                for (uint j = 0; j < 3; j++) {
+                    lo[j] = hi[j] = positions[j];
+                }
+                for (size_t v = 0; v < nvertex; v++) {
+                    for (uint j = 0; j < 3; j++) {
+                        lo[j] = std::min(lo[j], positions[3 * v + j]);
+                        hi[j] = std::max(hi[j], positions[3 * v + j]);
+                    }
+                }
+                for (size_t v = 0; v < nvertex; v++) {
+                    for (uint j = 0; j < 3; j++) {
+                        colors[3 * v + j] = (positions[3 * v + j] - lo[j]) /
+                                            std::max(hi[j] - lo[j], 1e-6f);
+                    }
+                }
+            }
+            const std::vector<int>& material_ids = shape.material_ids;
+            for (size_t f = 0; f < shape.indices.size(); f++) {
+                const int id =
+                    f / 3 < material_ids.size() ? material_ids[f / 3] : -1;
+                if (id < 0 || size_t(id) >= materials.size()) continue;
+                const float* diffuse = materials[id].diffuse;
+                for (uint j = 0; j < 3; j++) {
+                    colors[3 * shape.indices[f] + j] = diffuse[j];
+                }
+            }
+
+            vx_mesh_view_t mesh = {};
+            mesh.vertices = positions.data();
+            mesh.colors = colors.data();
+            mesh.indices = shape.indices.data();
+            mesh.nindices = shape.indices.size();
+            mesh.nvertices = nvertex;
+            meshes.push_back(mesh);
+        }
+
+        if (!mesh_cache::write(model, meshes)) {
+            std::cerr << "could not write " << mesh_cache::path_of(model)
+                      << std::endl;
+        }
     }
+    printf("loading: %.1f ms%s\n",
+           std::chrono::duration<double, std::milli>(
+               std::chrono::high_resolution_clock::now() - load_start)
+               .count(),
+           cache.size() > 0 ? " from the mesh cache" : "");
+
+    auto load_stop = std::chrono::high_resolution_clock::now();
 
     size_t voffset = 0;
     size_t noffset = 0;
 
     std::vector<vx_vertex_t> vertexes;
     std::vector<vx_vec3_t> normals;
+    std::vector<vx_color_t> colors;
     float res = 0.0025;
     float precision = 0.001;
 
-    for (size_t i = 0; i < shapes.size(); i++) {
-        vx_mesh_t* mesh;
-
-        mesh = vx_mesh_alloc(shapes[i].mesh.positions.size(),
-                             shapes[i].mesh.indices.size());
-
-        for (size_t f = 0; f < shapes[i].mesh.indices.size(); f++) {
-            mesh->indices[f] = shapes[i].mesh.indices[f];
-        }
-        for (size_t v = 0; v < shapes[i].mesh.positions.size() / 3; v++) {
-            mesh->vertices[v].x = shapes[i].mesh.positions[3 * v + 0];
-            mesh->vertices[v].y = shapes[i].mesh.positions[3 * v + 1];
-            mesh->vertices[v].z = shapes[i].mesh.positions[3 * v + 2];
-        }
+    // runs body(i) for i in [0, n) on all cores, one shape per task
+    auto parallel_for = [](size_t n, auto body) {
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, n, 1),
+                          [&](const tbb::blocked_range<size_t>& r) {
+                              for (size_t i = r.begin(); i != r.end(); i++) {
+                                  body(i);
+                              }
+                          });
+    };
 
-        vx_point_cloud_t* result;
-        result = vx_voxelize_pc(mesh, res, res, res, precision);
+    // voxelize the shapes concurrently, largest first so no thread is left
+    // with a big one at the end
+    std::vector<vx_point_cloud_t*> clouds(meshes.size());
+    std::vector<size_t> order(meshes.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return meshes[a].nindices > meshes[b].nindices;
+    });
+    parallel_for(order.size(), [&](size_t i) {
+        const vx_mesh_view_t& mesh = meshes[order[i]];
+        clouds[order[i]] =
+            vx_voxelize_pc_view(&mesh, res, res, res, precision);
+    });
+    auto voxelize_stop = std::chrono::high_resolution_clock::now();
+    const double voxelize_seconds =
+        std::chrono::duration<double>(voxelize_stop - load_stop).count();
 
-        for (int i = 0; i < result->nvertices; i++) {
-            vertexes.push_back(result->vertices[i]);
-            normals.push_back(result->normals[i]);
+    // every shape gets its own segment of the outputs, in shape order
+    std::vector<size_t> offsets(clouds.size() + 1, 0);
+    for (size_t i = 0; i < clouds.size(); i++) {
+        offsets[i + 1] = offsets[i] + clouds[i]->nvertices;
+    }
+    vertexes.resize(offsets.back());
+    normals.resize(offsets.back());
+    colors.resize(offsets.back());
+    parallel_for(clouds.size(), [&](size_t i) {
+        vx_point_cloud_t* result = clouds[i];
+        std::copy(result->vertices, result->vertices + result->nvertices,
+                  vertexes.begin() + offsets[i]);
+        std::copy(result->normals, result->normals + result->nvertices,
+                  normals.begin() + offsets[i]);
+        if (result->colors) {
+            std::copy(result->colors, result->colors + result->nvertices,
+                      colors.begin() + offsets[i]);
         }
-
         vx_point_cloud_free(result);
-        vx_mesh_free(mesh);
-    }
+    });
+    auto merge_stop = std::chrono::high_resolution_clock::now();
 
     printf("Number of vertices: %ld\n", vertexes.size());
+    printf("voxelization: %.3f s, %.2f M voxels/s over %ld shapes\n",
+           voxelize_seconds, vertexes.size() / voxelize_seconds / 1e6,
+           meshes.size());
 
     // begin fsh
-    using pixel = bool;
+    // voxel color
+    using pixel = fsh::rgb565;
     const uint d = 3;
     using PosInt = uint16_t;
     using NorInt = int8_t;
     using HashInt = uint8_t;
     using map = fsh::map<d, pixel, PosInt, NorInt, HashInt>;
+    using set = fsh::set<d, PosInt, NorInt, HashInt>;
     using PosPoint = fsh::point<d, PosInt>;
     using NorPoint = fsh::point<d, NorInt>;
     using IndexInt = uint64_t;
@@ -109,44 +248,49 @@ int main(int argc, char** argv) {
         }
     }
 
-    std::vector<map::data_t> data;
-    std::set<IndexInt> data_b;
+    // normals snap to the precomputed normal of their octahedral cell
+    const fsh::normal_quantizer<NorInt> quantize_normals(normalprec);
+    std::vector<NorPoint> quantized(normals.size());
+    quantize_normals(normals.data()->v, normals.size(), quantized.data());
 
-    using std::round;
+    std::vector<map::data_t> data(vertexes.size());
     PosPoint boundings = {0, 0, 0};
     for (size_t i = 0; i < vertexes.size(); i++) {
         const vx_vertex_t& v = vertexes[i];
-        const vx_vec3_t& vn = normals[i];
+        const vx_color_t& c = colors[i];
         PosPoint p;
-        NorPoint n;
         for (uint i = 0; i < d; i++) {
             PosInt u = std::round((v.v[i] - minVal) * scale);
             boundings[i] = max(boundings[i], u);
             p[i] = u;
-
-            PosInt w = std::round(vn.v[i] * normalprec);
-            n[i] = w;
-        }
-        NorInt g = std::abs(n[0]);
-        for (uint i = 1; i < d; i++) {
-            g = std::__gcd(g, (NorInt)std::abs(n[i]));
         }
-        for (uint i = 0; i < d; i++) {
-            n[i] /= g;
+        data[i] = map::data_t{p, quantized[i], pixel::pack(c.r, c.g, c.b)};
+    }
+
+    // sort and dedupe by packed location, only as many bits per coordinate
+    // as the bounding box needs
+    uint location_bits = 1;
+    for (uint i = 0; i < d; i++) {
+        while ((uint64_t(1) << location_bits) <= boundings[i]) {
+            location_bits++;
         }
-        data.push_back(map::data_t{p, n, pixel{true}});
     }
+    fsh::radix_sort_unique(
+        data,
+        [&](const map::data_t& it) {
+            return fsh::pack_location(it.location, location_bits);
+        },
+        d * location_bits);
 
-    std::sort(data.begin(), data.end(),
-              [](const map::data_t& lhs, const map::data_t& rhs) {
-                  return lhs.location < rhs.location;
-              });
-    auto newend =
-        std::unique(data.begin(), data.end(),
-                    [](const map::data_t& lhs, const map::data_t& rhs) {
-                        return lhs.location == rhs.location;
-                    });
-    data.erase(newend, data.end());
+    auto ingest_stop = std::chrono::high_resolution_clock::now();
+    auto ms = [](auto from, auto to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    };
+    printf("ingest: %.1f ms (load %.1f, voxelize %.1f, merge %.1f, "
+           "prepare %.1f)\n",
+           ms(load_start, ingest_stop), ms(load_start, load_stop),
+           ms(load_stop, voxelize_stop), ms(voxelize_stop, merge_stop),
+           ms(merge_stop, ingest_stop));
 
     PosPoint border = boundings + PosInt(1);
     IndexInt data_max_size = 1;
@@ -155,16 +299,33 @@ int main(int argc, char** argv) {
         data_max_size *= border[i];
         width = max(border[i], width);
     }
+    // ground truth for the exhaustive test, one bit per cell of the box
+    fsh::bitset data_b(data_max_size);
     for (const auto& it : data) {
-        data_b.insert(fsh::point_to_index<d>(it.location, border, uint(-1)));
+        data_b.add(fsh::point_to_index<d>(it.location, border, uint(-1)));
     }
 
     std::cout << "data size: " << data.size() << std::endl;
+    {
+        std::vector<NorPoint> distinct;
+        for (const auto& it : data) {
+            distinct.push_back(it.normal);
+        }
+        std::sort(distinct.begin(), distinct.end());
+        std::cout << "distinct normals: "
+                  << std::unique(distinct.begin(), distinct.end()) -
+                         distinct.begin()
+                  << std::endl;
+    }
     std::cout << "data density: " << float(data.size()) / std::pow(width, d)
               << std::endl;
 
     auto start_time = std::chrono::high_resolution_clock::now();
-    map s([&](size_t i) { return data[i]; }, data.size(), boundings);
+    // only occupancy is needed, so the voxels go into a set
+    auto set_data = [&](size_t i) {
+        return set::data_t{data[i].location, data[i].normal};
+    };
+    set s(set_data, data.size(), boundings);
     auto stop_time = std::chrono::high_resolution_clock::now();
 
     auto original_data_size =
@@ -200,46 +361,777 @@ int main(int argc, char** argv) {
                      1000.0f
               << " seconds" << std::endl;
 
+    // the same set with its normals clustered into at most max_normals
+    const size_t max_normals = 256;
+    set capped(set_data, data.size(), boundings, fsh::layout::row_major,
+               max_normals);
+    auto normal_report = [&](const char* name, const set& it) {
+        std::cout << name << ": " << it.normal_count() << " normals, "
+                  << float(it.normal_index_bits()) / data.size()
+                  << " normal index bits/voxel, "
+                  << it.memory_size() / (1024 * 1024.0f) << " mb" << std::endl;
+    };
+    normal_report("all normals", s);
+    normal_report("capped normals", capped);
+
+    // the same set with the slots of H in tiles of 8 x 8 surface points
+    set tiled(set_data, data.size(), boundings, fsh::layout::morton);
+    std::cout << "morton layout size: "
+              << tiled.memory_size() / (1024 * 1024.0f) << " mb" << std::endl;
+
+    // the same voxels with their colors
+    map colored([&](size_t i) { return data[i]; }, data.size(), boundings);
+    std::cout << "colored map size: "
+              << colored.memory_size() / (1024 * 1024.0f) << " mb"
+              << std::endl;
+
+    // the same colors as indices into a dense array of them, once per
+    // voxel and once per distinct color
+    using indexed = fsh::indexed_map<d, pixel, PosInt, NorInt, HashInt>;
+    auto color_data = [&](size_t i) { return data[i]; };
+    indexed indexed_colors(color_data, data.size(), boundings);
+    indexed deduped_colors(color_data, data.size(), boundings, true);
+    std::cout << "indexed map size: "
+              << indexed_colors.memory_size() / (1024 * 1024.0f)
+              << " mb, deduplicated "
+              << deduped_colors.memory_size() / (1024 * 1024.0f) << " mb, "
+              << deduped_colors.contents().size() << " distinct colors"
+              << std::endl;
+    {
+        // every voxel finds its color in both and in a saved and loaded
+        // copy of the deduplicated one
+        std::stringstream stream;
+        deduped_colors.save(stream);
+        const std::string bytes = stream.str();
+        const char* cursor = bytes.data();
+        indexed loaded = indexed::load(cursor);
+        size_t wrong = cursor != bytes.data() + bytes.size();
+        for (const auto& it : data) {
+            for (const indexed* m :
+                 {&indexed_colors, &deduped_colors, &loaded}) {
+                const pixel* found = m->find(it.location);
+                wrong += found == nullptr || found->bits != it.contents.bits;
+            }
+        }
+        if (wrong != 0) {
+            std::cout << wrong << " colors lost by the indexed maps!"
+                      << std::endl;
+        }
+    }
+    // vx_voxelize_snap_3dgrid keeps one rgba word per cell
+    std::cout << "dense color grid size: "
+              << data_max_size * sizeof(uint32_t) / (1024 * 1024.0f) << " mb"
+              << std::endl;
+
 #if 1
     std::cout << "exhaustive test" << std::endl;
-    for (IndexInt i = 0; i < data_max_size; i++) {
-        PosPoint p = fsh::index_to_point<d>(i, border, IndexInt(-1));
-        pixel exists = data_b.count(i);
-        try {
-            s.get(p);
+    for (fsh::grid_cursor<d, PosInt> c(border); c.valid(); ++c) {
+        const IndexInt i = c.index();
+        const PosPoint& p = *c;
+        bool exists = data_b.test(i);
+        if (s.contains(p)) {
             if (!exists) {
                 std::cout << "found non-existing element!" << std::endl;
                 std::cout << i << std::endl;
                 std::cout << p << std::endl;
             }
-        } catch (const std::out_of_range& e) {
-            if (exists) {
-                std::cout << "didn't find existing element!" << std::endl;
-                std::cout << i << std::endl;
-                std::cout << p << std::endl;
-            }
+        } else if (exists) {
+            std::cout << "didn't find existing element!" << std::endl;
+            std::cout << i << std::endl;
+            std::cout << p << std::endl;
+        }
+        if (capped.contains(p) != exists) {
+            std::cout << "capped set disagrees!" << std::endl;
+            std::cout << p << std::endl;
+        }
+        if ((indexed_colors.find(p) != nullptr) != exists) {
+            std::cout << "indexed map disagrees!" << std::endl;
+            std::cout << p << std::endl;
+        }
+        if (tiled.contains(p) != exists) {
+            std::cout << "morton layout set disagrees!" << std::endl;
+            std::cout << p << std::endl;
         }
     }
     std::cout << "finished!" << std::endl;
 #endif
+
+#if 1
+    std::cout << "projection test" << std::endl;
+    {
+        // the integer move_to_box against the double one, over random
+        // boxes, offsets, normals and points
+        std::mt19937 rng(2028);
+        size_t mismatches = 0, tested = 0;
+        std::vector<PosPoint> points(1000);
+        for (int round = 0; round < 2000; round++) {
+            // mostly small boxes, some up to the full coordinate range
+            const uint limit = round % 10 ? 4096 : PosInt(-1);
+            PosPoint box;
+            for (uint j = 0; j < d; j++) {
+                box[j] = 1 + rng() % limit;
+            }
+            const PosInt offset = rng() % (1 + std::min({box[0], box[1],
+                                                         box[2], PosInt(16)}));
+            NorPoint vn;
+            do {
+                for (uint j = 0; j < d; j++) {
+                    vn[j] = NorInt(rng() % 256 - 128);
+                }
+            } while (vn == NorPoint::point_zero());
+            for (auto& p : points) {
+                for (uint j = 0; j < d; j++) {
+                    p[j] = rng() % (box[j] - offset + 1);
+                }
+            }
+            mismatches +=
+                map::projection_mismatches(box, offset, vn, points);
+            tested += points.size();
+        }
+        std::cout << mismatches << " of " << tested
+                  << " projections differ from move_to_box_double"
+                  << std::endl;
+    }
+#endif
+
+#if 1
+    std::cout << "normal quantizer test" << std::endl;
+    {
+        // the batched quantizer against one call per normal, on the voxel
+        // normals and on random directions
+        std::mt19937 rng(2049);
+        std::normal_distribution<float> gauss;
+        std::vector<float> directions(3 * (normals.size() + (1 << 20)));
+        std::copy(normals.data()->v, normals.data()->v + 3 * normals.size(),
+                  directions.begin());
+        for (size_t i = 3 * normals.size(); i < directions.size(); i++) {
+            directions[i] = gauss(rng);
+        }
+        const size_t count = directions.size() / 3;
+        std::vector<NorPoint> batched(count), single(count);
+        auto t0 = std::chrono::high_resolution_clock::now();
+        quantize_normals(directions.data(), count, batched.data());
+        auto t1 = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < count; i++) {
+            single[i] = quantize_normals(&directions[3 * i]);
+        }
+        auto t2 = std::chrono::high_resolution_clock::now();
+        size_t mismatches = 0;
+        for (size_t i = 0; i < count; i++) {
+            mismatches += batched[i] != single[i];
+        }
+        auto ns_per_normal = [&](auto from, auto to) {
+            return std::chrono::duration<double, std::nano>(to - from)
+                       .count() /
+                   count;
+        };
+        std::cout << quantize_normals.cell_count() << "^2 cells, batched "
+                  << ns_per_normal(t0, t1) << " ns/normal, single "
+                  << ns_per_normal(t1, t2) << " ns/normal, " << mismatches
+                  << " of " << count << " differ" << std::endl;
+    }
+#endif
+
+#if 1
+    std::cout << "curve test" << std::endl;
+    {
+        std::mt19937_64 rng(2029);
+        using CodePoint = fsh::point<d, uint32_t>;
+        size_t failed = 0;
+        // morton codes round trip at 21 bits per axis, hilbert codes at
+        // every width up to that
+        for (int round = 0; round < 100000; round++) {
+            CodePoint p;
+            for (uint j = 0; j < d; j++) {
+                p[j] = rng() & 0x1fffff;
+            }
+            failed +=
+                fsh::morton_decode<d, uint32_t>(fsh::morton_encode(p)) != p;
+            const uint bits = 1 + round % 21;
+            for (uint j = 0; j < d; j++) {
+                p[j] &= (uint32_t(1) << bits) - 1;
+            }
+            const uint64_t code = fsh::hilbert_encode(p, bits);
+            failed += code >> (d * bits) != 0 ||
+                      fsh::hilbert_decode<d, uint32_t>(code, bits) != p;
+        }
+        // consecutive hilbert codes are neighbouring cells
+        const uint bits = 5;
+        for (uint64_t code = 0; code + 1 < uint64_t(1) << (d * bits);
+             code++) {
+            const CodePoint a = fsh::hilbert_decode<d, uint32_t>(code, bits);
+            const CodePoint b =
+                fsh::hilbert_decode<d, uint32_t>(code + 1, bits);
+            uint32_t steps = 0;
+            for (uint j = 0; j < d; j++) {
+                steps += a[j] > b[j] ? a[j] - b[j] : b[j] - a[j];
+            }
+            failed += steps != 1;
+        }
+        // morton cursors over two halves of the codes of a box visit every
+        // point of it once, in code order
+        for (int round = 0; round < 50; round++) {
+            PosPoint box;
+            for (uint j = 0; j < d; j++) {
+                box[j] = 1 + rng() % 48;
+            }
+            using cursor = fsh::morton_cursor<d, PosInt>;
+            const uint64_t end = cursor::code_end(box);
+            const uint64_t split = rng() % end;
+            fsh::bitset seen(fsh::grid_cursor<d, PosInt>::size(box));
+            uint64_t visited = 0;
+            for (const auto& range :
+                 {std::make_pair(uint64_t(0), split),
+                  std::make_pair(split, end)}) {
+                uint64_t last = range.first;
+                for (cursor c(box, range.first, range.second); c.valid();
+                     ++c) {
+                    const PosPoint& p = *c;
+                    bool ok = c.code() >= last && c.code() < range.second &&
+                              fsh::morton_encode(p) == c.code();
+                    for (uint j = 0; j < d; j++) {
+                        ok &= p[j] < box[j];
+                    }
+                    const uint64_t i = fsh::point_to_index<d>(p, box, uint(-1));
+                    failed += !ok || seen.test(i);
+                    seen.add(i);
+                    last = c.code() + 1;
+                    visited++;
+                }
+            }
+            failed += visited != fsh::grid_cursor<d, PosInt>::size(box);
+        }
+        std::cout << failed << " curve checks failed" << std::endl;
+    }
+#endif
+
+#if 1
+    std::cout << "lookup benchmark" << std::endl;
+    {
+        // random queries inside the bounding box, so most lookups miss cache
+        const size_t nquery = 1 << 22;
+        std::mt19937 rng(2018);
+        std::vector<PosPoint> queries(nquery);
+        for (auto& q : queries) {
+            for (uint j = 0; j < d; j++) {
+                q[j] = rng() % border[j];
+            }
+        }
+        std::unique_ptr<bool[]> found(new bool[nquery]);
+
+        auto t0 = std::chrono::high_resolution_clock::now();
+        size_t hits_single = 0;
+        for (size_t i = 0; i < nquery; i++) {
+            hits_single += s.contains(queries[i]);
+        }
+        auto t1 = std::chrono::high_resolution_clock::now();
+        s.contains_many(queries.data(), nquery, found.get());
+        size_t hits_batch = 0;
+        for (size_t i = 0; i < nquery; i++) {
+            hits_batch += found[i];
+        }
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        auto ns_per_lookup = [&](auto from, auto to) {
+            return std::chrono::duration<double, std::nano>(to - from).count() /
+                   nquery;
+        };
+        std::cout << "contains: " << ns_per_lookup(t0, t1) << " ns/lookup"
+                  << std::endl;
+        std::cout << "contains_many: " << ns_per_lookup(t1, t2) << " ns/lookup"
+                  << std::endl;
+        if (hits_single != hits_batch) {
+            std::cout << "contains_many disagrees with contains!"
+                      << std::endl;
+        }
+
+        // both layouts of H on the random queries and on the voxels in
+        // location order, whose neighbours land on neighbouring slots
+        std::vector<PosPoint> walk(data.size());
+        for (size_t i = 0; i < data.size(); i++) {
+            walk[i] = data[i].location;
+        }
+        auto time_lookups = [&](const set& it,
+                                const std::vector<PosPoint>& ps,
+                                size_t expected) {
+            auto from = std::chrono::high_resolution_clock::now();
+            size_t hits = 0;
+            for (const auto& p : ps) {
+                hits += it.contains(p);
+            }
+            auto to = std::chrono::high_resolution_clock::now();
+            if (hits != expected) {
+                std::cout << "layouts disagree!" << std::endl;
+            }
+            return std::chrono::duration<double, std::nano>(to - from)
+                       .count() /
+                   ps.size();
+        };
+        for (const auto& it : {std::make_pair("row_major", &s),
+                               std::make_pair("morton", &tiled)}) {
+            std::cout << it.first << " layout: random "
+                      << time_lookups(*it.second, queries, hits_single)
+                      << " ns/lookup, voxel walk "
+                      << time_lookups(*it.second, walk, data.size())
+                      << " ns/lookup" << std::endl;
+        }
+
+        // the same queries split over threads reading one shared map
+        const set& shared = s;
+        const uint max_threads =
+            std::max(1u, std::thread::hardware_concurrency());
+        for (uint nthread = 1; nthread <= max_threads; nthread *= 2) {
+            std::vector<std::thread> threads;
+            std::vector<size_t> hits(nthread);
+            auto t3 = std::chrono::high_resolution_clock::now();
+            for (uint t = 0; t < nthread; t++) {
+                threads.emplace_back([&, t]() {
+                    size_t ret = 0;
+                    for (size_t i = nquery * t / nthread;
+                         i < nquery * (t + 1) / nthread; i++) {
+                        ret += shared.contains(queries[i]);
+                    }
+                    hits[t] = ret;
+                });
+            }
+            for (auto& it : threads) {
+                it.join();
+            }
+            auto t4 = std::chrono::high_resolution_clock::now();
+            double seconds = std::chrono::duration<double>(t4 - t3).count();
+            std::cout << nthread << " threads: " << nquery / seconds / 1e6
+                      << " M lookups/s" << std::endl;
+            if (std::accumulate(hits.begin(), hits.end(), size_t(0)) !=
+                hits_single) {
+                std::cout << "threaded lookups disagree with contains!"
+                          << std::endl;
+            }
+        }
+
+        // read latency through a versioned handle, first with the map
+        // left alone, then while a new version is built in the background
+        using clock = std::chrono::steady_clock;
+        auto build = [&]() {
+            return std::make_shared<const set>(set_data, data.size(),
+                                               boundings);
+        };
+        fsh::versioned<set> handle(build());
+        // keeps the last nquery latencies
+        std::vector<uint32_t> latencies;
+        size_t hits_versioned = 0;
+        auto read = [&](size_t i) {
+            auto q0 = clock::now();
+            fsh::versioned<set>::snapshot snapshot = handle.acquire();
+            hits_versioned += snapshot->contains(queries[i % nquery]);
+            auto q1 = clock::now();
+            uint32_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              q1 - q0)
+                              .count();
+            if (latencies.size() < nquery) {
+                latencies.push_back(ns);
+            } else {
+                latencies[i % nquery] = ns;
+            }
+        };
+        auto report = [&](const char* name, size_t reads) {
+            if (latencies.empty()) {
+                return;
+            }
+            std::sort(latencies.begin(), latencies.end());
+            auto percentile = [&](double q) {
+                return latencies[size_t(q * (latencies.size() - 1))];
+            };
+            std::cout << name << ": " << reads << " reads, p50 "
+                      << percentile(0.5) << " ns, p99 " << percentile(0.99)
+                      << " ns, p99.9 " << percentile(0.999) << " ns, max "
+                      << latencies.back() << " ns" << std::endl;
+            latencies.clear();
+        };
+
+        for (size_t i = 0; i < nquery; i++) {
+            read(i);
+        }
+        report("idle", nquery);
+        if (hits_versioned != hits_single) {
+            std::cout << "versioned lookups disagree with contains!"
+                      << std::endl;
+        }
+
+        handle.rebuild(build);
+        size_t reads = 0;
+        while (handle.rebuilding()) {
+            read(reads++);
+        }
+        handle.wait();
+        report("rebuilding", reads);
+        if (handle.version() != 1) {
+            std::cout << "rebuilt map was not published!" << std::endl;
+        }
+    }
+#endif
+
+#if 1
+    std::cout << "edit benchmark" << std::endl;
+    {
+        // erase a slice of the voxels and insert it again, one at a time
+        fsh::dynamic_map<d, pixel, PosInt, NorInt, HashInt> dyn(
+            [&](size_t i) { return data[i]; }, data.size(), boundings);
+        const size_t nedit = std::min(data.size(), size_t(1) << 16);
+        auto t0 = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < nedit; i++) {
+            dyn.erase(data[i].location);
+        }
+        for (size_t i = 0; i < nedit; i++) {
+            dyn.insert(data[i]);
+        }
+        auto t1 = std::chrono::high_resolution_clock::now();
+        std::cout << "edit: "
+                  << std::chrono::duration<double, std::micro>(t1 - t0)
+                             .count() /
+                         (2 * nedit)
+                  << " us/edit, " << dyn.overflow_size()
+                  << " keys in overflow, " << dyn.rebuilds() << " rebuilds"
+                  << std::endl;
+        dyn.wait();
+        size_t missing = 0;
+        for (const auto& it : data) {
+            missing += dyn.find(it.location) == nullptr;
+        }
+        if (missing != 0) {
+            std::cout << missing << " edited voxels missing!" << std::endl;
+        }
+
+        // voxels the map was not built with: the last quarter in location
+        // order, a slab at the far end of x whose rows hold few normals
+        const size_t nbuilt = data.size() - data.size() / 4;
+        fsh::dynamic_map<d, pixel, PosInt, NorInt, HashInt> grown(
+            [&](size_t i) { return data[i]; }, nbuilt, boundings);
+        const size_t built_normals = grown.table().normal_count();
+        size_t placed = 0, spilled = 0, swapped = 0;
+        auto t2 = std::chrono::high_resolution_clock::now();
+        for (size_t i = nbuilt; i < data.size(); i++) {
+            const size_t overflow = grown.overflow_size();
+            const size_t rebuilds = grown.rebuilds();
+            grown.insert(data[i]);
+            if (grown.rebuilds() != rebuilds) {
+                swapped++;
+            } else if (grown.overflow_size() > overflow) {
+                spilled++;
+            } else {
+                placed++;
+            }
+        }
+        auto t3 = std::chrono::high_resolution_clock::now();
+        std::cout << "new keys: "
+                  << std::chrono::duration<double, std::micro>(t3 - t2)
+                             .count() /
+                         (data.size() - nbuilt)
+                  << " us/insert, " << placed
+                  << " into H or a redirect bucket, " << spilled
+                  << " into overflow";
+        if (swapped != 0) {
+            std::cout << ", " << swapped << " while a rebuild was swapped in";
+        }
+        std::cout << ", " << grown.rebuilds() << " rebuilds, "
+                  << grown.table().normal_count() - built_normals
+                  << " normals added" << std::endl;
+        grown.wait();
+        missing = 0;
+        for (const auto& it : data) {
+            const pixel* found = grown.find(it.location);
+            missing += found == nullptr || found->bits != it.contents.bits;
+        }
+        if (missing != 0) {
+            std::cout << missing << " inserted voxels missing!" << std::endl;
+        }
+    }
+#endif
+#if 1
+    std::cout << "sharded map test" << std::endl;
+    {
+        // the voxels twice, the second copy 2^30 cells further along x,
+        // in bricks of 32 cells per axis
+        using sharded = fsh::sharded_map<d, pixel, NorInt, HashInt, 5>;
+        using WidePoint = fsh::point<d, uint32_t>;
+        const uint32_t far = uint32_t(1) << 30;
+        auto sharded_data = [&](size_t i) {
+            const map::data_t& it = data[i % data.size()];
+            WidePoint p;
+            for (uint j = 0; j < d; j++) {
+                p[j] = it.location[j];
+            }
+            if (i >= data.size()) {
+                p[0] += far;
+            }
+            return sharded::data_t{p, it.normal, it.contents};
+        };
+        const size_t n = 2 * data.size();
+
+        // build time with the brick maps built on 1, 2, 4... threads
+        std::unique_ptr<sharded> m;
+        double base_ms = 0;
+        const uint max_threads =
+            std::max(1u, std::thread::hardware_concurrency());
+        for (uint nthread = 1; nthread <= max_threads; nthread *= 2) {
+            tbb::global_control limit(
+                tbb::global_control::max_allowed_parallelism, nthread);
+            auto t0 = std::chrono::high_resolution_clock::now();
+            m = std::make_unique<sharded>(sharded_data, n);
+            auto t1 = std::chrono::high_resolution_clock::now();
+            const double build_ms = ms(t0, t1);
+            if (nthread == 1) {
+                base_ms = build_ms;
+            }
+            std::cout << nthread << " threads: " << m->brick_count()
+                      << " bricks built in " << build_ms << " ms, speedup "
+                      << base_ms / build_ms << std::endl;
+        }
+        std::cout << "sharded map size: "
+                  << m->memory_size() / (1024 * 1024.0f) << " mb"
+                  << std::endl;
+
+        // every cell of both copies of the box, and the voxel contents
+        size_t wrong = 0;
+        for (fsh::grid_cursor<d, PosInt> c(border); c.valid(); ++c) {
+            const bool exists = data_b.test(c.index());
+            WidePoint p;
+            for (uint j = 0; j < d; j++) {
+                p[j] = (*c)[j];
+            }
+            wrong += (m->find(p) != nullptr) != exists;
+            p[0] += far;
+            wrong += (m->find(p) != nullptr) != exists;
+        }
+        for (size_t i = 0; i < n; i++) {
+            const sharded::data_t it = sharded_data(i);
+            const pixel* found = m->find(it.location);
+            wrong += found == nullptr || found->bits != it.contents.bits;
+        }
+        std::cout << wrong << " wrong sharded lookups" << std::endl;
+    }
+#endif
+#if 1
+    std::cout << "paged map test" << std::endl;
+    {
+        using paged = fsh::paged_map<d, pixel, NorInt, HashInt, 5>;
+        using WidePoint = fsh::point<d, uint32_t>;
+        auto wide = [&](const PosPoint& q) {
+            WidePoint p;
+            for (uint j = 0; j < d; j++) {
+                p[j] = q[j];
+            }
+            return p;
+        };
+        const std::string path = "paged_test.bricks";
+        auto t0 = std::chrono::high_resolution_clock::now();
+        paged::build(
+            path,
+            [&](size_t i) {
+                return paged::data_t{wide(data[i].location), data[i].normal,
+                                     data[i].contents};
+            },
+            data.size());
+        auto t1 = std::chrono::high_resolution_clock::now();
+        std::cout << "paged build: " << ms(t0, t1) << " ms" << std::endl;
+
+        // a voxel walk with every brick resident gives the size of all of
+        // them, then the whole box is checked with a quarter of that
+        size_t total_bytes = 0;
+        {
+            paged all(path, size_t(-1));
+            for (const auto& it : data) {
+                all.find(wide(it.location));
+            }
+            total_bytes = all.statistics().resident_bytes;
+        }
+        paged m(path, total_bytes / 4);
+        size_t wrong = 0;
+        auto t2 = std::chrono::high_resolution_clock::now();
+        for (fsh::grid_cursor<d, PosInt> c(border); c.valid(); ++c) {
+            const bool exists = data_b.test(c.index());
+            wrong += (m.find(wide(*c)) != nullptr) != exists;
+        }
+        for (const auto& it : data) {
+            const pixel* found = m.find(wide(it.location));
+            wrong += found == nullptr || found->bits != it.contents.bits;
+        }
+        auto t3 = std::chrono::high_resolution_clock::now();
+        const paged::stats& st = m.statistics();
+        std::cout << m.brick_count() << " bricks, "
+                  << total_bytes / (1024 * 1024.0f) << " mb, budget "
+                  << total_bytes / 4 / (1024 * 1024.0f) << " mb: " << st.hits
+                  << " hits, " << st.misses << " misses, " << st.evictions
+                  << " evictions, " << st.resident_bricks << " bricks ("
+                  << st.resident_bytes / (1024 * 1024.0f)
+                  << " mb) resident, " << ms(t2, t3) << " ms" << std::endl;
+        std::cout << wrong << " wrong paged lookups" << std::endl;
+        std::remove(path.c_str());
+    }
+#endif
     // end fsh
 
+    if (headless) {
+        // loadOBJ only reads v/vt/vn triangles, others fail with it
+        std::cout << "obj loader benchmark" << std::endl;
+        for (const std::string& it : models) {
+            const char* path = it.c_str();
+            double megabytes = 0;
+            if (FILE* file = fopen(path, "rb")) {
+                fseek(file, 0, SEEK_END);
+                megabytes = ftell(file) / 1e6;
+                fclose(file);
+            }
+            auto report = [&](const char* name, auto load) {
+                auto t0 = std::chrono::high_resolution_clock::now();
+                bool ok = load();
+                auto t1 = std::chrono::high_resolution_clock::now();
+                double seconds = std::chrono::duration<double>(t1 - t0).count();
+                std::cout << path << " " << name << ": ";
+                if (ok) {
+                    std::cout << seconds * 1e3 << " ms, "
+                              << megabytes / seconds << " MB/s";
+                } else {
+                    std::cout << "failed";
+                }
+                std::cout << std::endl;
+            };
+            report("loadOBJ", [&]() {
+                std::vector<glm::vec3> vertices, normals;
+                std::vector<glm::vec2> uvs;
+                return loadOBJ(path, vertices, uvs, normals);
+            });
+            report("loadOBJIndexed", [&]() {
+                std::vector<unsigned int> indices;
+                std::vector<glm::vec3> vertices, normals;
+                std::vector<glm::vec2> uvs;
+                return loadOBJIndexed(path, indices, vertices, uvs, normals);
+            });
+            std::vector<tinyobj::shape_t> reference;
+            report("tinyobj::LoadObj", [&]() {
+                std::vector<tinyobj::material_t> materials;
+                std::string err;
+                return tinyobj::LoadObj(reference, materials, err, path);
+            });
+            // the mapped loader on one thread, then on every core
+            const unsigned max_threads =
+                std::max(1u, std::thread::hardware_concurrency());
+            std::vector<unsigned> thread_counts = {1};
+            if (max_threads > 1) {
+                thread_counts.push_back(max_threads);
+            }
+            for (unsigned nthread : thread_counts) {
+                std::vector<tinyobj::shape_t> mapped;
+                const std::string name = "tinyobj::LoadObjMapped, " +
+                                         std::to_string(nthread) + " threads";
+                report(name.c_str(), [&]() {
+                    std::vector<tinyobj::material_t> materials;
+                    std::string err;
+                    return tinyobj::LoadObjMapped(mapped, materials, err, path,
+                                                  NULL, nthread);
+                });
+                bool same = mapped.size() == reference.size();
+                for (size_t i = 0; same && i < mapped.size(); i++) {
+                    const tinyobj::mesh_t& a = mapped[i].mesh;
+                    const tinyobj::mesh_t& b = reference[i].mesh;
+                    same = mapped[i].name == reference[i].name &&
+                           a.positions == b.positions &&
+                           a.normals == b.normals &&
+                           a.texcoords == b.texcoords &&
+                           a.indices == b.indices &&
+                           a.material_ids == b.material_ids;
+                }
+                if (!same) {
+                    std::cout << "LoadObjMapped disagrees with LoadObj!"
+                              << std::endl;
+                }
+            }
+        }
+    }
+
+    if (headless) {
+        // the vertex welder of indexVBO_slow against the linear search it
+        // replaced, which keeps the first similar vertex
+        std::cout << "vertex welder check" << std::endl;
+        for (const std::string& it : models) {
+            std::vector<glm::vec3> vertices, normals;
+            std::vector<glm::vec2> uvs;
+            if (!loadOBJ(it.c_str(), vertices, uvs, normals)) {
+                continue;
+            }
+            // the linear search is quadratic, so only a prefix is welded
+            const size_t n = std::min(vertices.size(), size_t(1) << 15);
+            vertices.resize(n);
+            uvs.resize(n);
+            normals.resize(n);
+
+            std::vector<unsigned int> indices, linear_indices;
+            std::vector<glm::vec3> welded, welded_normals;
+            std::vector<glm::vec2> welded_uvs;
+            auto t0 = std::chrono::high_resolution_clock::now();
+            indexVBO_slow(vertices, uvs, normals, indices, welded, welded_uvs,
+                          welded_normals);
+            auto t1 = std::chrono::high_resolution_clock::now();
+            std::vector<size_t> linear;
+            auto near = [](float a, float b) { return fabs(a - b) < 0.01f; };
+            for (size_t i = 0; i < n; i++) {
+                size_t j = 0;
+                for (; j < linear.size(); j++) {
+                    const size_t k = linear[j];
+                    if (near(vertices[i].x, vertices[k].x) &&
+                        near(vertices[i].y, vertices[k].y) &&
+                        near(vertices[i].z, vertices[k].z) &&
+                        near(uvs[i].x, uvs[k].x) && near(uvs[i].y, uvs[k].y) &&
+                        near(normals[i].x, normals[k].x) &&
+                        near(normals[i].y, normals[k].y) &&
+                        near(normals[i].z, normals[k].z)) {
+                        break;
+                    }
+                }
+                if (j == linear.size()) {
+                    linear.push_back(i);
+                }
+                linear_indices.push_back(j);
+            }
+            auto t2 = std::chrono::high_resolution_clock::now();
+            bool same = indices == linear_indices &&
+                        welded.size() == linear.size();
+            for (size_t j = 0; same && j < linear.size(); j++) {
+                same = welded[j] == vertices[linear[j]];
+            }
+            std::cout << it << ": " << n << " vertices welded into "
+                      << welded.size() << ", welder "
+                      << ms(t0, t1) << " ms, linear search " << ms(t1, t2)
+                      << " ms" << std::endl;
+            if (!same) {
+                std::cout << "welder disagrees with the linear search!"
+                          << std::endl;
+            }
+        }
+    }
+
+    if (headless) {
+        return EXIT_SUCCESS;
+    }
+
     // using data
 #if 1
     vertexes.clear();
     cout << "Reading data" << endl;
-    for (IndexInt i = 0; i < data_max_size; i++) {
-        PosPoint p = fsh::index_to_point<d>(i, border, IndexInt(-1));
-        try {
-            s.get(p);
+    std::vector<pixel> voxel_colors;
+    for (fsh::grid_cursor<d, PosInt> c(border); c.valid(); ++c) {
+        const PosPoint& p = *c;
+        if (const pixel* color = colored.find(p)) {
             vx_vertex_t vt;
             for (uint j = 0; j < d; j++) {
                 vt.v[j] = 1.0f * p[j] / scale + minVal;
             }
             vertexes.push_back(vt);
-        } catch (const std::out_of_range& e) {
+            voxel_colors.push_back(*color);
         }
     }
+    std::vector<float> vertex_colors(3 * voxel_colors.size());
+    fsh::unpack_colors(voxel_colors.data(), voxel_colors.size(),
+                       vertex_colors.data());
     cout << "End reading" << endl;
 
     vx_vertex_t bound_min = vertexes[0];
@@ -315,6 +1207,12 @@ int main(int argc, char** argv) {
     glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertexes.size() * 3,
                  vertexes.data(), GL_STATIC_DRAW);
 
+    GLuint colorbuffer;
+    glGenBuffers(1, &colorbuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertex_colors.size(),
+                 vertex_colors.data(), GL_STATIC_DRAW);
+
     do {
         // Clear the screen
         glClear(GL_COLOR_BUFFER_BIT);
@@ -344,6 +1242,11 @@ int main(int argc, char** argv) {
                               (void*)0   // array buffer offset
         );
 
+        // 2nd attribute buffer : colors
+        glEnableVertexAttribArray(1);
+        glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
         // glPointSize(2.0f);
 
         // Draw the triangle !
@@ -351,6 +1254,7 @@ int main(int argc, char** argv) {
                      vertexes.size());  // 3 indices starting at 0 -> 1 triangle
 
         glDisableVertexAttribArray(0);
+        glDisableVertexAttribArray(1);
 
         // Swap buffers
         glfwSwapBuffers(window);
@@ -362,6 +1266,7 @@ int main(int argc, char** argv) {
 
     // Cleanup VBO
     glDeleteBuffers(1, &vertexbuffer);
+    glDeleteBuffers(1, &colorbuffer);
     glDeleteVertexArrays(1, &VertexArrayID);
     glDeleteProgram(programID);
 
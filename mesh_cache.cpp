@@ -0,0 +1,245 @@
+#include "mesh_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    const char magic[8] = {'v', 'x', 'm', 'e', 's', 'h', '\0', '\0'};
+    const uint32_t version = 2;
+    // every array starts at a multiple of this in the file
+    const size_t alignment = 16;
+
+    struct header {
+        char magic[8];
+        uint32_t version;
+        uint32_t nmeshes;
+        uint64_t source_size;
+        uint64_t source_hash;
+    };
+
+    // byte offsets of the arrays of a mesh, 0 when it has none
+    struct record {
+        uint64_t nvertices;
+        uint64_t nindices;
+        uint64_t vertices;
+        uint64_t colors;
+        uint64_t indices;
+    };
+
+    size_t aligned(size_t offset) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    // maps path read only, returns nullptr on failure or for an empty file
+    const char* map_file(const std::string& path, size_t& size) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size = (size_t)st.st_size;
+            p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+        return p == MAP_FAILED ? nullptr : (const char*)p;
+#else
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in || in.tellg() <= 0) {
+            return nullptr;
+        }
+        size = (size_t)in.tellg();
+        char* p = new char[size];
+        in.seekg(0);
+        if (!in.read(p, size)) {
+            delete[] p;
+            return nullptr;
+        }
+        return p;
+#endif
+    }
+
+    void unmap_file(const char* data, size_t size) {
+#ifndef _WIN32
+        munmap((void*)data, size);
+#else
+        delete[] data;
+#endif
+    }
+
+    // size and hash of the .obj, false when it can not be read
+    bool identify(const std::string& obj_path, uint64_t& size,
+                  uint64_t& hash) {
+        size_t length = 0;
+        const char* data = map_file(obj_path, length);
+        if (!data) {
+            return false;
+        }
+        size = length;
+        hash = mesh_cache::hash(data, length);
+        unmap_file(data, length);
+        return true;
+    }
+}  // namespace
+
+uint64_t mesh_cache::hash(const char* data, size_t size) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+bool mesh_cache::open(const std::string& obj_path) {
+    close();
+    uint64_t source_size, source_hash;
+    if (!identify(obj_path, source_size, source_hash)) {
+        return false;
+    }
+    data = map_file(path_of(obj_path), length);
+    if (!data) {
+        return false;
+    }
+
+    header h;
+    if (length < sizeof(h)) {
+        close();
+        return false;
+    }
+    memcpy(&h, data, sizeof(h));
+    if (memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version ||
+        h.source_size != source_size || h.source_hash != source_hash ||
+        length < sizeof(h) + h.nmeshes * sizeof(record)) {
+        close();
+        return false;
+    }
+
+    // checks that count elements of size bytes at offset lie in the file
+    auto inside = [&](uint64_t offset, uint64_t count, size_t size) {
+        return offset % alignment == 0 && offset <= length &&
+               count <= (length - offset) / size;
+    };
+    const record* records = (const record*)(data + sizeof(h));
+    for (uint32_t i = 0; i < h.nmeshes; i++) {
+        const record& r = records[i];
+        if (!inside(r.vertices, r.nvertices, 3 * sizeof(float)) ||
+            !inside(r.indices, r.nindices, sizeof(unsigned int)) ||
+            (r.colors && !inside(r.colors, r.nvertices, 3 * sizeof(float)))) {
+            close();
+            return false;
+        }
+        // a cache that does not match its header must not send the
+        // voxelizer outside the vertices
+        const unsigned int* indices = (const unsigned int*)(data + r.indices);
+        for (uint64_t j = 0; j < r.nindices; j++) {
+            if (indices[j] >= r.nvertices) {
+                close();
+                return false;
+            }
+        }
+        vx_mesh_view_t m;
+        m.vertices = (const float*)(data + r.vertices);
+        m.vertexstride = 0;
+        m.colors = r.colors ? (const float*)(data + r.colors) : nullptr;
+        m.colorstride = 0;
+        m.indices = indices;
+        m.indexstride = 0;
+        m.nindices = r.nindices;
+        m.nvertices = r.nvertices;
+        meshes.push_back(m);
+    }
+    return true;
+}
+
+void mesh_cache::close() {
+    if (data) {
+        unmap_file(data, length);
+    }
+    data = nullptr;
+    length = 0;
+    meshes.clear();
+}
+
+bool mesh_cache::write(const std::string& obj_path,
+                       const std::vector<vx_mesh_view_t>& meshes) {
+    header h;
+    memcpy(h.magic, magic, sizeof(magic));
+    h.version = version;
+    h.nmeshes = (uint32_t)meshes.size();
+    if (!identify(obj_path, h.source_size, h.source_hash)) {
+        return false;
+    }
+
+    // lay the arrays out after the header and records
+    std::vector<record> records(meshes.size());
+    size_t offset = sizeof(h) + sizeof(record) * records.size();
+    auto place = [&](size_t bytes) {
+        offset = aligned(offset);
+        size_t ret = offset;
+        offset += bytes;
+        return ret;
+    };
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const vx_mesh_view_t& m = meshes[i];
+        record& r = records[i];
+        r.nvertices = m.nvertices;
+        r.nindices = m.nindices;
+        r.vertices = place(3 * sizeof(float) * m.nvertices);
+        r.colors = m.colors ? place(3 * sizeof(float) * m.nvertices) : 0;
+        r.indices = place(sizeof(unsigned int) * m.nindices);
+    }
+
+    std::vector<char> out(offset, 0);
+    memcpy(out.data(), &h, sizeof(h));
+    memcpy(out.data() + sizeof(h), records.data(),
+           sizeof(record) * records.size());
+    // packs count elements of size bytes, stride apart (0 when packed)
+    auto put = [&](uint64_t at, const void* from, size_t stride, size_t count,
+                   size_t size) {
+        if (!at) {
+            return;
+        }
+        if (stride == 0 || stride == size) {
+            memcpy(out.data() + at, from, size * count);
+            return;
+        }
+        for (size_t i = 0; i < count; i++) {
+            memcpy(out.data() + at + i * size, (const char*)from + i * stride,
+                   size);
+        }
+    };
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const vx_mesh_view_t& m = meshes[i];
+        const record& r = records[i];
+        put(r.vertices, m.vertices, m.vertexstride, m.nvertices,
+            3 * sizeof(float));
+        put(r.colors, m.colors, m.colorstride, m.nvertices, 3 * sizeof(float));
+        put(r.indices, m.indices, m.indexstride, m.nindices,
+            sizeof(unsigned int));
+    }
+
+    // write next to the cache and rename, so a reader never maps a partly
+    // written file
+    const std::string path = path_of(obj_path);
+    const std::string temporary = path + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file.write(out.data(), out.size());
+    // a failed flush on close leaves a truncated file
+    file.close();
+    if (!file) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
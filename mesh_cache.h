@@ -0,0 +1,50 @@
+#pragma once
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "voxelizer.h"
+
+// binary copy of the meshes made out of an .obj file, kept next to it in
+// "<obj>.cache" so later runs skip parsing. the cache holds the size and
+// an FNV-1a hash of the .obj it was made from and is ignored once those
+// change. open() maps the whole file at once and the meshes are views into
+// the mapping, nothing is copied
+class mesh_cache {
+public:
+    mesh_cache() = default;
+    mesh_cache(const mesh_cache&) = delete;
+    mesh_cache& operator=(const mesh_cache&) = delete;
+    ~mesh_cache() { close(); }
+
+    // maps the cache of obj_path, returns false when there is none or it was
+    // made from other contents of obj_path
+    bool open(const std::string& obj_path);
+    void close();
+
+    size_t size() const { return meshes.size(); }
+    // mesh i, valid while the cache is open
+    const vx_mesh_view_t& mesh(size_t i) const { return meshes[i]; }
+
+    // writes the vertices, colors and indices of meshes as the cache of
+    // obj_path, tightly packed whatever their strides
+    static bool write(const std::string& obj_path,
+                      const std::vector<vx_mesh_view_t>& meshes);
+
+    static std::string path_of(const std::string& obj_path) {
+        return obj_path + ".cache";
+    }
+
+    // FNV-1a, 64 bits
+    static uint64_t hash(const char* data, size_t size);
+
+private:
+    const char* data = nullptr;
+    size_t length = 0;
+    std::vector<vx_mesh_view_t> meshes;
+};
+
+#endif
@@ -25,10 +25,12 @@ using namespace glm;
 #include <algorithm>
 
 #include "psh.hpp"
+#include "fsh/util.hpp"
 #include <experimental/optional>
 #include <chrono>
 #include <stdint.h>
 #include <thread>
+#include <tbb/enumerable_thread_specific.h>
 
 #include <set>
 
@@ -158,22 +160,29 @@ int main(int argc, char** argv) {
     using std::endl;
 
     cout << (int)width << endl;
+    const fsh::point<d, PosInt> grid = fsh::point<d, PosInt>::repeating(width);
 #if 1
     std::cout << "exhaustive test" << std::endl;
     tbb::parallel_for(
-        IndexInt(0), IndexInt(width * width * width), [&](IndexInt i) {
-            point p = psh::index_to_point<d>(i, width, IndexInt(-1));
-            pixel exists = data_b.count(i);
-            try {
-                s.get(p);
-                if (!exists) {
-                    std::cout << "found non-existing element!" << std::endl;
-                    std::cout << p << std::endl;
-                }
-            } catch (const std::out_of_range& e) {
-                if (exists) {
-                    std::cout << "didn't find existing element!" << std::endl;
-                    std::cout << p << std::endl;
+        tbb::blocked_range<IndexInt>(0, IndexInt(width * width * width)),
+        [&](const tbb::blocked_range<IndexInt>& r) {
+            for (fsh::grid_cursor<d, PosInt> c(grid, r.begin(), r.end());
+                 c.valid(); ++c) {
+                point p = {(*c)[0], (*c)[1], (*c)[2]};
+                pixel exists = data_b.count(c.index());
+                try {
+                    s.get(p);
+                    if (!exists) {
+                        std::cout << "found non-existing element!"
+                                  << std::endl;
+                        std::cout << p << std::endl;
+                    }
+                } catch (const std::out_of_range& e) {
+                    if (exists) {
+                        std::cout << "didn't find existing element!"
+                                  << std::endl;
+                        std::cout << p << std::endl;
+                    }
                 }
             }
         });
@@ -187,26 +196,45 @@ int main(int argc, char** argv) {
     vx_vertex_t maxCenter = {-1.0f, -1.0f, -1.0f};
     vx_vertex_t center = {0.0f, 0.0f, 0.0f};
     bool first = true;
-    tbb::mutex mutex;
+    // every thread collects into its own buffer, merged after the loop
+    struct collected {
+        std::vector<vx_vertex_t> vertices;
+        vx_vertex_t minCenter = {1.0f, 1.0f, 1.0f};
+        vx_vertex_t maxCenter = {-1.0f, -1.0f, -1.0f};
+    };
+    tbb::enumerable_thread_specific<collected> per_thread;
     std::cout << "Reading Data" << std::endl;
     tbb::parallel_for(
-        IndexInt(0), IndexInt(width * width * width), [&](IndexInt i) {
-            point p = psh::index_to_point<d>(i, width, IndexInt(-1));
-            try {
-                s.get(p);
-                psh::point<d, float> pp = static_cast<psh::point<d, float>>(p);
-                vx_vertex_t v = {pp[0], pp[1], pp[2]};
-                tbb::mutex::scoped_lock lock(mutex);
-                for (int j = 0; j < 3; j++) {
-                    auto& u = v.v[j];
-                    u = u / scale + minVal;
-                    minCenter.v[j] = min(minCenter.v[j], u);
-                    maxCenter.v[j] = max(maxCenter.v[j], u);
+        tbb::blocked_range<IndexInt>(0, IndexInt(width * width * width)),
+        [&](const tbb::blocked_range<IndexInt>& r) {
+            collected& local = per_thread.local();
+            for (fsh::grid_cursor<d, PosInt> c(grid, r.begin(), r.end());
+                 c.valid(); ++c) {
+                point p = {(*c)[0], (*c)[1], (*c)[2]};
+                try {
+                    s.get(p);
+                    psh::point<d, float> pp =
+                        static_cast<psh::point<d, float>>(p);
+                    vx_vertex_t v = {pp[0], pp[1], pp[2]};
+                    for (int j = 0; j < 3; j++) {
+                        auto& u = v.v[j];
+                        u = u / scale + minVal;
+                        local.minCenter.v[j] = min(local.minCenter.v[j], u);
+                        local.maxCenter.v[j] = max(local.maxCenter.v[j], u);
+                    }
+                    local.vertices.push_back(v);
+                } catch (const std::out_of_range& e) {
                 }
-                vertices_psh.push_back(v);
-            } catch (const std::out_of_range& e) {
             }
         });
+    for (const collected& it : per_thread) {
+        vertices_psh.insert(vertices_psh.end(), it.vertices.begin(),
+                            it.vertices.end());
+        for (int j = 0; j < 3; j++) {
+            minCenter.v[j] = min(minCenter.v[j], it.minCenter.v[j]);
+            maxCenter.v[j] = max(maxCenter.v[j], it.maxCenter.v[j]);
+        }
+    }
     std::cout << "Finished" << std::endl;
     for (int i = 0; i < 3; i++) {
         center.v[i] = (minCenter.v[i] + maxCenter.v[i]) / 2;
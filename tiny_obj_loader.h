@@ -116,6 +116,16 @@ namespace tinyobj {
                  std::string &err,                    // [output]
                  const char *filename, const char *mtl_basepath = NULL);
 
+    /// Loads .obj from a file like LoadObj, but maps the file into memory
+    /// and parses line-aligned chunks of it on 'num_threads' threads, one
+    /// per hardware thread when 0. Shapes, indices and materials come out
+    /// the same as with LoadObj.
+    bool LoadObjMapped(std::vector<shape_t> &shapes,        // [output]
+                       std::vector<material_t> &materials,  // [output]
+                       std::string &err,                    // [output]
+                       const char *filename, const char *mtl_basepath = NULL,
+                       unsigned int num_threads = 0);
+
     /// Loads object from a std::istream, uses GetMtlIStreamFn to retrieve
     /// std::istream for materials.
     /// Returns true when loading .obj become success.
@@ -144,6 +154,15 @@ namespace tinyobj {
 #include <map>
 #include <fstream>
 #include <sstream>
+#include <thread>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "tiny_obj_loader.h"
 
@@ -160,15 +179,84 @@ namespace tinyobj {
         vertex_index(int vidx, int vtidx, int vnidx)
             : v_idx(vidx), vt_idx(vtidx), vn_idx(vnidx) {}
     };
-    // for std::map
-    static inline bool operator<(const vertex_index &a, const vertex_index &b) {
-        if (a.v_idx != b.v_idx) return (a.v_idx < b.v_idx);
-        if (a.vn_idx != b.vn_idx) return (a.vn_idx < b.vn_idx);
-        if (a.vt_idx != b.vt_idx) return (a.vt_idx < b.vt_idx);
-
-        return false;
+    static inline bool operator==(const vertex_index &a,
+                                  const vertex_index &b) {
+        return a.v_idx == b.v_idx && a.vn_idx == b.vn_idx &&
+               a.vt_idx == b.vt_idx;
     }
 
+    // Open addressing hash table from the (v, vn, vt) indices of a face
+    // corner to the vertex made of it. clear() only bumps a generation, so
+    // one cache is reused for every face group.
+    class vertex_cache {
+    public:
+        vertex_cache() : m_count(0), m_generation(1) { m_slots.resize(1024); }
+
+        // Returns the index of the vertex of vi and sets found, or claims a
+        // slot for vi and returns it for the caller to fill.
+        unsigned int &lookup(const vertex_index &vi, bool &found) {
+            if (2 * (m_count + 1) > m_slots.size()) grow();
+            slot &s = probe(vi);
+            found = s.generation == m_generation;
+            if (!found) {
+                s.key = vi;
+                s.generation = m_generation;
+                m_count++;
+            }
+            return s.value;
+        }
+
+        void clear() {
+            m_count = 0;
+            if (++m_generation == 0) {
+                // Wrapped around, old generations could look current.
+                std::vector<slot>(m_slots.size()).swap(m_slots);
+                m_generation = 1;
+            }
+        }
+
+    private:
+        struct slot {
+            vertex_index key;
+            unsigned int value;
+            unsigned int generation;  // 0 or stale when empty
+            slot() : key(-1), value(0), generation(0) {}
+        };
+
+        static size_t hash(const vertex_index &vi) {
+            unsigned long long h =
+                static_cast<unsigned int>(vi.v_idx) * 0x9E3779B97F4A7C15ull ^
+                (static_cast<unsigned long long>(
+                     static_cast<unsigned int>(vi.vn_idx))
+                     << 32 |
+                 static_cast<unsigned int>(vi.vt_idx)) *
+                    0xC2B2AE3D27D4EB4Full;
+            return static_cast<size_t>(h ^ (h >> 29));
+        }
+
+        slot &probe(const vertex_index &vi) {
+            size_t mask = m_slots.size() - 1;
+            for (size_t i = hash(vi) & mask;; i = (i + 1) & mask) {
+                slot &s = m_slots[i];
+                if (s.generation != m_generation || s.key == vi) return s;
+            }
+        }
+
+        void grow() {
+            std::vector<slot> old(m_slots.size() * 2);
+            old.swap(m_slots);
+            for (size_t i = 0; i < old.size(); i++) {
+                if (old[i].generation == m_generation) {
+                    probe(old[i].key) = old[i];
+                }
+            }
+        }
+
+        std::vector<slot> m_slots;  // Power of two, at most half full
+        size_t m_count;
+        unsigned int m_generation;
+    };
+
     struct obj_shape {
         std::vector<float> v;
         std::vector<float> vn;
@@ -364,12 +452,21 @@ namespace tinyobj {
         z = parseFloat(token);
     }
 
+    // Make index zero-base like fixIndex, and flag bit in relative when the
+    // index was relative.
+    static inline int fixIndex(int idx, int n, int *relative, int bit) {
+        if (idx < 0 && relative) *relative |= bit;
+        return fixIndex(idx, n);
+    }
+
     // Parse triples: i, i/j/k, i//k, i/j
+    // When given, relative gets 1, 2 and 4 set for a relative v, vt and vn
+    // index.
     static vertex_index parseTriple(const char *&token, int vsize, int vnsize,
-                                    int vtsize) {
+                                    int vtsize, int *relative = NULL) {
         vertex_index vi(-1);
 
-        vi.v_idx = fixIndex(atoi(token), vsize);
+        vi.v_idx = fixIndex(atoi(token), vsize, relative, 1);
         token += strcspn(token, "/ \t\r");
         if (token[0] != '/') {
             return vi;
@@ -379,13 +476,13 @@ namespace tinyobj {
         // i//k
         if (token[0] == '/') {
             token++;
-            vi.vn_idx = fixIndex(atoi(token), vnsize);
+            vi.vn_idx = fixIndex(atoi(token), vnsize, relative, 4);
             token += strcspn(token, "/ \t\r");
             return vi;
         }
 
         // i/j/k or i/j
-        vi.vt_idx = fixIndex(atoi(token), vtsize);
+        vi.vt_idx = fixIndex(atoi(token), vtsize, relative, 2);
         token += strcspn(token, "/ \t\r");
         if (token[0] != '/') {
             return vi;
@@ -393,23 +490,23 @@ namespace tinyobj {
 
         // i/j/k
         token++;  // skip '/'
-        vi.vn_idx = fixIndex(atoi(token), vnsize);
+        vi.vn_idx = fixIndex(atoi(token), vnsize, relative, 4);
         token += strcspn(token, "/ \t\r");
         return vi;
     }
 
     static unsigned int updateVertex(
-        std::map<vertex_index, unsigned int> &vertexCache,
-        std::vector<float> &positions, std::vector<float> &normals,
-        std::vector<float> &texcoords, const std::vector<float> &in_positions,
+        vertex_cache &vertexCache, std::vector<float> &positions,
+        std::vector<float> &normals, std::vector<float> &texcoords,
+        const std::vector<float> &in_positions,
         const std::vector<float> &in_normals,
         const std::vector<float> &in_texcoords, const vertex_index &i) {
-        const std::map<vertex_index, unsigned int>::iterator it =
-            vertexCache.find(i);
+        bool found;
+        unsigned int &cached = vertexCache.lookup(i, found);
 
-        if (it != vertexCache.end()) {
+        if (found) {
             // found cache
-            return it->second;
+            return cached;
         }
 
         assert(in_positions.size() >
@@ -436,7 +533,7 @@ namespace tinyobj {
         }
 
         unsigned int idx = static_cast<unsigned int>(positions.size() / 3 - 1);
-        vertexCache[i] = idx;
+        cached = idx;
 
         return idx;
     }
@@ -465,7 +562,7 @@ namespace tinyobj {
     }
 
     static bool exportFaceGroupToShape(
-        shape_t &shape, std::map<vertex_index, unsigned int> vertexCache,
+        shape_t &shape, vertex_cache &vertexCache,
         const std::vector<float> &in_positions,
         const std::vector<float> &in_normals,
         const std::vector<float> &in_texcoords,
@@ -804,7 +901,7 @@ namespace tinyobj {
 
         // material
         std::map<std::string, int> material_map;
-        std::map<vertex_index, unsigned int> vertexCache;
+        vertex_cache vertexCache;
         int material = -1;
 
         shape_t shape;
@@ -1021,6 +1118,365 @@ namespace tinyobj {
         return true;
     }
 
+    // Read-only view of a whole file, memory mapped where mmap is available.
+    class MappedFile {
+    public:
+        MappedFile() : m_data(NULL), m_size(0), m_mapped(false) {}
+        ~MappedFile() {
+#ifndef _WIN32
+            if (m_mapped) munmap(const_cast<char *>(m_data), m_size);
+#endif
+        }
+
+        bool open(const char *filename) {
+#ifndef _WIN32
+            int fd = ::open(filename, O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                close(fd);
+                return false;
+            }
+            m_size = static_cast<size_t>(st.st_size);
+            if (m_size > 0) {
+                void *p = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED) {
+                    close(fd);
+                    return false;
+                }
+                m_data = static_cast<const char *>(p);
+                m_mapped = true;
+            }
+            close(fd);
+            return true;
+#else
+            std::ifstream ifs(filename, std::ios::binary);
+            if (!ifs) return false;
+            m_buffer.assign(std::istreambuf_iterator<char>(ifs),
+                            std::istreambuf_iterator<char>());
+            m_data = m_buffer.empty() ? NULL : &m_buffer[0];
+            m_size = m_buffer.size();
+            return true;
+#endif
+        }
+
+        const char *data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+    private:
+        MappedFile(const MappedFile &);
+        MappedFile &operator=(const MappedFile &);
+
+        const char *m_data;
+        size_t m_size;
+        bool m_mapped;
+#ifdef _WIN32
+        std::vector<char> m_buffer;
+#endif
+    };
+
+    // Everything LoadObjMapped parses out of one line-aligned chunk of an
+    // .obj file, independently of the other chunks.
+    struct obj_chunk {
+        std::vector<float> v;
+        std::vector<float> vn;
+        std::vector<float> vt;
+        // Corners of all faces in order, face_sizes[i] of them for face i.
+        std::vector<vertex_index> corners;
+        std::vector<unsigned int> face_sizes;
+        // Corners holding relative indices, resolved against the vertices of
+        // this chunk only, with the parseTriple bits of which ones. They
+        // still need the vertex counts of the chunks before.
+        std::vector<std::pair<size_t, int> > relative;
+
+        // A line other than geometry, to replay in file order.
+        struct command {
+            char kind;  // 'g', 'o', 'u'semtl or 'm'tllib
+            std::string name;
+            size_t face;  // Faces of the chunk before it
+        };
+        std::vector<command> commands;
+    };
+
+    static void parseObjChunk(const char *begin, const char *end,
+                              obj_chunk *chunk) {
+        std::vector<char> linebuf;
+
+        for (const char *line = begin; line < end;) {
+            const char *eol = static_cast<const char *>(
+                memchr(line, '\n', static_cast<size_t>(end - line)));
+            if (!eol) eol = end;
+
+            // Copy the line so the parsers find it terminated.
+            size_t len = static_cast<size_t>(eol - line);
+            if (len > 0 && line[len - 1] == '\r') len--;
+            linebuf.assign(line, line + len);
+            linebuf.push_back('\0');
+            line = eol + 1;
+
+            // Skip leading space.
+            const char *token = &linebuf[0];
+            token += strspn(token, " \t");
+
+            if (token[0] == '\0') continue;  // empty line
+
+            if (token[0] == '#') continue;  // comment line
+
+            // vertex
+            if (token[0] == 'v' && isSpace((token[1]))) {
+                token += 2;
+                float x, y, z;
+                parseFloat3(x, y, z, token);
+                chunk->v.push_back(x);
+                chunk->v.push_back(y);
+                chunk->v.push_back(z);
+                continue;
+            }
+
+            // normal
+            if (token[0] == 'v' && token[1] == 'n' && isSpace((token[2]))) {
+                token += 3;
+                float x, y, z;
+                parseFloat3(x, y, z, token);
+                chunk->vn.push_back(x);
+                chunk->vn.push_back(y);
+                chunk->vn.push_back(z);
+                continue;
+            }
+
+            // texcoord
+            if (token[0] == 'v' && token[1] == 't' && isSpace((token[2]))) {
+                token += 3;
+                float x, y;
+                parseFloat2(x, y, token);
+                chunk->vt.push_back(x);
+                chunk->vt.push_back(y);
+                continue;
+            }
+
+            // face
+            if (token[0] == 'f' && isSpace((token[1]))) {
+                token += 2;
+                token += strspn(token, " \t");
+
+                unsigned int npolys = 0;
+                while (!isNewLine(token[0])) {
+                    int relative = 0;
+                    vertex_index vi = parseTriple(
+                        token, static_cast<int>(chunk->v.size() / 3),
+                        static_cast<int>(chunk->vn.size() / 3),
+                        static_cast<int>(chunk->vt.size() / 2), &relative);
+                    if (relative) {
+                        chunk->relative.push_back(std::pair<size_t, int>(
+                            chunk->corners.size(), relative));
+                    }
+                    chunk->corners.push_back(vi);
+                    npolys++;
+                    size_t n = strspn(token, " \t\r");
+                    token += n;
+                }
+
+                chunk->face_sizes.push_back(npolys);
+
+                continue;
+            }
+
+            obj_chunk::command command;
+            command.face = chunk->face_sizes.size();
+
+            // use mtl, load mtl and object name
+            bool usemtl =
+                (0 == strncmp(token, "usemtl", 6)) && isSpace((token[6]));
+            bool mtllib =
+                (0 == strncmp(token, "mtllib", 6)) && isSpace((token[6]));
+            bool object = token[0] == 'o' && isSpace((token[1]));
+            if (usemtl || mtllib || object) {
+                char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+                namebuf[0] = '\0';
+                token += object ? 2 : 7;
+#ifdef _MSC_VER
+                sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+                sscanf(token, "%s", namebuf);
+#endif
+                command.kind = usemtl ? 'u' : (mtllib ? 'm' : 'o');
+                command.name = namebuf;
+                chunk->commands.push_back(command);
+                continue;
+            }
+
+            // group name
+            if (token[0] == 'g' && isSpace((token[1]))) {
+                std::vector<std::string> names;
+                while (!isNewLine(token[0])) {
+                    std::string str = parseString(token);
+                    names.push_back(str);
+                    token += strspn(token, " \t\r");  // skip tag
+                }
+
+                // names[0] must be 'g', so skip the 0th element.
+                command.kind = 'g';
+                command.name = names.size() > 1 ? names[1] : "";
+                chunk->commands.push_back(command);
+                continue;
+            }
+
+            // Ignore unknown command.
+        }
+    }
+
+    bool LoadObjMapped(std::vector<shape_t> &shapes,        // [output]
+                       std::vector<material_t> &materials,  // [output]
+                       std::string &err, const char *filename,
+                       const char *mtl_basepath, unsigned int num_threads) {
+        shapes.clear();
+
+        std::stringstream errss;
+
+        MappedFile file;
+        if (!file.open(filename)) {
+            errss << "Cannot open file [" << filename << "]" << std::endl;
+            err = errss.str();
+            return false;
+        }
+
+        std::string basePath;
+        if (mtl_basepath) {
+            basePath = mtl_basepath;
+        }
+        MaterialFileReader matFileReader(basePath);
+
+        // One chunk per thread, but none smaller than 64KB.
+        if (num_threads == 0) num_threads = std::thread::hardware_concurrency();
+        size_t nchunks = file.size() / (64 * 1024);
+        if (nchunks > num_threads) nchunks = num_threads;
+        if (nchunks == 0) nchunks = 1;
+
+        // Chunk i is [bounds[i], bounds[i + 1]), each ends after a newline.
+        const char *end = file.data() + file.size();
+        std::vector<const char *> bounds(nchunks + 1, end);
+        bounds[0] = file.data();
+        for (size_t i = 1; i < nchunks; i++) {
+            const char *p = file.data() + file.size() / nchunks * i;
+            if (p < bounds[i - 1]) p = bounds[i - 1];
+            p = static_cast<const char *>(
+                memchr(p, '\n', static_cast<size_t>(end - p)));
+            bounds[i] = p ? p + 1 : end;
+        }
+
+        std::vector<obj_chunk> chunks(nchunks);
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < nchunks; i++) {
+            threads.push_back(std::thread(parseObjChunk, bounds[i],
+                                          bounds[i + 1], &chunks[i]));
+        }
+        parseObjChunk(bounds[0], bounds[1], &chunks[0]);
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+
+        // Stitch the vertices together and resolve relative indices.
+        size_t nv = 0, nvn = 0, nvt = 0;
+        for (size_t i = 0; i < nchunks; i++) {
+            nv += chunks[i].v.size();
+            nvn += chunks[i].vn.size();
+            nvt += chunks[i].vt.size();
+        }
+        std::vector<float> v;
+        std::vector<float> vn;
+        std::vector<float> vt;
+        v.reserve(nv);
+        vn.reserve(nvn);
+        vt.reserve(nvt);
+        for (size_t i = 0; i < nchunks; i++) {
+            obj_chunk &chunk = chunks[i];
+            for (size_t r = 0; r < chunk.relative.size(); r++) {
+                vertex_index &vi = chunk.corners[chunk.relative[r].first];
+                int relative = chunk.relative[r].second;
+                if (relative & 1) vi.v_idx += static_cast<int>(v.size() / 3);
+                if (relative & 2) vi.vt_idx += static_cast<int>(vt.size() / 2);
+                if (relative & 4) vi.vn_idx += static_cast<int>(vn.size() / 3);
+            }
+            v.insert(v.end(), chunk.v.begin(), chunk.v.end());
+            vn.insert(vn.end(), chunk.vn.begin(), chunk.vn.end());
+            vt.insert(vt.end(), chunk.vt.begin(), chunk.vt.end());
+        }
+
+        // Replay faces and commands in file order as LoadObj would.
+        std::vector<std::vector<vertex_index> > faceGroup;
+        std::string name;
+        std::map<std::string, int> material_map;
+        vertex_cache vertexCache;
+        int material = -1;
+
+        shape_t shape;
+
+        for (size_t i = 0; i < nchunks; i++) {
+            const obj_chunk &chunk = chunks[i];
+            size_t corner = 0;
+            size_t face = 0;
+
+            for (size_t c = 0; c <= chunk.commands.size(); c++) {
+                size_t upto = c < chunk.commands.size()
+                                  ? chunk.commands[c].face
+                                  : chunk.face_sizes.size();
+                for (; face < upto; face++) {
+                    size_t npolys = chunk.face_sizes[face];
+                    faceGroup.push_back(std::vector<vertex_index>(
+                        chunk.corners.begin() + corner,
+                        chunk.corners.begin() + corner + npolys));
+                    corner += npolys;
+                }
+                if (c == chunk.commands.size()) break;
+
+                const obj_chunk::command &command = chunk.commands[c];
+                if (command.kind == 'm') {
+                    std::string err_mtl;
+                    bool ok = matFileReader(command.name, materials,
+                                            material_map, err_mtl);
+                    err += err_mtl;
+
+                    if (!ok) {
+                        faceGroup.clear();  // for safety
+                        return false;
+                    }
+                    continue;
+                }
+
+                // Flush previous face group.
+                bool ret =
+                    exportFaceGroupToShape(shape, vertexCache, v, vn, vt,
+                                           faceGroup, material, name, true);
+                if (ret) {
+                    shapes.push_back(shape);
+                }
+                shape = shape_t();
+                faceGroup.clear();
+
+                if (command.kind == 'u') {
+                    if (material_map.find(command.name) != material_map.end()) {
+                        material = material_map[command.name];
+                    } else {
+                        // { error!! material not found }
+                        material = -1;
+                    }
+                } else {
+                    name = command.name;
+                }
+            }
+        }
+
+        bool ret = exportFaceGroupToShape(shape, vertexCache, v, vn, vt,
+                                          faceGroup, material, name, true);
+        if (ret) {
+            shapes.push_back(shape);
+        }
+        faceGroup.clear();  // for safety
+
+        err += errss.str();
+        return true;
+    }
+
 }  // namespace tinyobj
 
 #endif
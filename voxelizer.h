@@ -93,6 +93,22 @@ typedef struct vx_point_cloud {
     vx_vec3_t* normals;
 } vx_point_cloud_t;
 
+// A triangle mesh in buffers owned by the caller, read in place. Strides are
+// in bytes, a stride of 0 means tightly packed elements
+typedef struct vx_mesh_view {
+    const float* vertices;        // x, y, z of the first vertex
+    size_t vertexstride;          // Bytes from one vertex to the next
+    const float* colors;          // r, g, b of the first vertex, or NULL
+    size_t colorstride;           // Bytes from one color to the next
+    const unsigned int* indices;  // Triangle indices
+    size_t indexstride;           // Bytes from one index to the next
+    size_t nindices;              // The number of indices
+    size_t nvertices;             // The number of vertices
+} vx_mesh_view_t;
+
+// Returns a view of the vertices, colors and indices of mesh
+vx_mesh_view_t vx_mesh_view(vx_mesh_t const* mesh);
+
 // vx_voxelize_pc: Voxelizes a triangle mesh to a point cloud
 vx_point_cloud_t* vx_voxelize_pc(
     vx_mesh_t const* mesh,  // The input mesh
@@ -102,6 +118,15 @@ vx_point_cloud_t* vx_voxelize_pc(
     float precision);       // A precision factor that reduces "holes artifact
                             // usually a precision = voxelsize / 10. works ok
 
+// vx_voxelize_pc_view: Voxelizes a view of a triangle mesh to a point cloud,
+// like vx_voxelize_pc
+vx_point_cloud_t* vx_voxelize_pc_view(
+    vx_mesh_view_t const* view,  // The input mesh
+    float voxelsizex,            // Voxel size on X-axis
+    float voxelsizey,            // Voxel size on Y-axis
+    float voxelsizez,            // Voxel size on Z-axis
+    float precision);            // See vx_voxelize_pc
+
 // vx_voxelize: Voxelizes a triangle mesh to a triangle mesh representing cubes
 vx_mesh_t* vx_voxelize(
     vx_mesh_t const* mesh,  // The input mesh
@@ -121,6 +146,31 @@ unsigned int* vx_voxelize_snap_3dgrid(
     unsigned int height,    // The texture resolution on y-axis
     unsigned int depth);    // The texture resolution on z-axis
 
+typedef struct vx_sparse_voxel {
+    unsigned int x;      // Grid coordinates of the voxel
+    unsigned int y;
+    unsigned int z;
+    unsigned int color;  // RGBA8 color, as in vx_voxelize_snap_3dgrid
+} vx_sparse_voxel_t;
+
+typedef struct vx_sparse_grid {
+    vx_sparse_voxel_t* voxels;  // The non-empty voxels, ordered by their
+                                // index x + y * width + z * width * height
+    size_t nvoxels;             // The number of non-empty voxels
+    unsigned int width;         // The grid resolution on x-axis
+    unsigned int height;        // The grid resolution on y-axis
+    unsigned int depth;         // The grid resolution on z-axis
+} vx_sparse_grid_t;
+
+// vx_voxelize_snap_3dgrid_sparse: Voxelizes a triangle mesh to the same grid
+// as vx_voxelize_snap_3dgrid, but only returns the non-empty voxels, so memory
+// stays proportional to the surface instead of the volume
+vx_sparse_grid_t* vx_voxelize_snap_3dgrid_sparse(
+    vx_mesh_t const* mesh,  // The input mesh
+    unsigned int width,     // The grid resolution on x-axis
+    unsigned int height,    // The grid resolution on y-axis
+    unsigned int depth);    // The grid resolution on z-axis
+
 // Allocates a mesh that can contain nvertices vertices, nindices indices
 vx_mesh_t* vx_mesh_alloc(int nvertices, int nindices);
 
@@ -135,6 +185,9 @@ void vx_mesh_free(vx_mesh_t* mesh);
 // Free a point cloud allocated after a call of vx_voxelize_pc
 void vx_point_cloud_free(vx_point_cloud_t* pointcloud);
 
+// Free a sparse grid allocated after a call of vx_voxelize_snap_3dgrid_sparse
+void vx_sparse_grid_free(vx_sparse_grid_t* grid);
+
 // Voxelizer Helpers, define your own if needed
 #ifndef VOXELIZER_HELPERS
 #define VOXELIZER_HELPERS 1
@@ -321,10 +374,19 @@ void vx_point_cloud_free(vx_point_cloud_t* pc) {
     pc->vertices = NULL;
     VX_FREE(pc->colors);
     pc->colors = NULL;
+    VX_FREE(pc->normals);
+    pc->normals = NULL;
     pc->nvertices = 0;
     VX_FREE(pc);
 }
 
+void vx_sparse_grid_free(vx_sparse_grid_t* grid) {
+    VX_FREE(grid->voxels);
+    grid->voxels = NULL;
+    grid->nvoxels = 0;
+    VX_FREE(grid);
+}
+
 vx_mesh_t* vx_mesh_alloc(int nvertices, int nindices) {
     vx_mesh_t* mesh = VX_MALLOC(vx_mesh_t, 1);
     mesh->indices = VX_CALLOC(unsigned int, nindices);
@@ -613,6 +675,66 @@ float vx__triangle_area(vx_triangle_t* triangle) {
     return sqrtf(powf(a0, 2.f) + powf(a1, 2.f) + powf(a2, 2.f)) * 0.5f;
 }
 
+typedef struct vx_triangle_setup {
+    vx_vec3_t normal;  // Unit normal of the triangle
+    vx_vec3_t e1;      // Edge p2 - p1
+    vx_vec3_t e2;      // Edge p3 - p2
+    vx_vec3_t e3;      // Edge p1 - p3
+} vx_triangle_setup_t;
+
+// Computes what vx__voxelize needs of a triangle once instead of per voxel
+void vx__triangle_setup(vx_triangle_t* triangle, vx_triangle_setup_t* setup) {
+    vx_vec3_t p1 = triangle->p1;
+    vx_vec3_t p2 = triangle->p2;
+
+    vx__vec3_sub(&p1, &triangle->p3);
+    vx__vec3_sub(&p2, &triangle->p3);
+    setup->normal = vx__vec3_cross(&p1, &p2);
+    vx__vec3_normalize(&setup->normal);
+
+    setup->e1 = triangle->p2;
+    setup->e2 = triangle->p3;
+    setup->e3 = triangle->p1;
+    vx__vec3_sub(&setup->e1, &triangle->p1);
+    vx__vec3_sub(&setup->e2, &triangle->p2);
+    vx__vec3_sub(&setup->e3, &triangle->p3);
+}
+
+// Area of the triangle spanned by edge e starting at a and the point p, the
+// same as vx__triangle_area of (a, a + e, p)
+float vx__edge_area(vx_vec3_t* e, vx_vec3_t* a, vx_vec3_t p) {
+    vx__vec3_sub(&p, a);
+
+    float a0 = e->y * p.z - e->z * p.y;
+    float a1 = e->z * p.x - e->x * p.z;
+    float a2 = e->x * p.y - e->y * p.x;
+
+    return sqrtf(powf(a0, 2.f) + powf(a1, 2.f) + powf(a2, 2.f)) * 0.5f;
+}
+
+// Interpolates the vertex colors of a triangle at p, every vertex weighted by
+// the area of p and the edge across from it
+vx_color_t vx__triangle_color(vx_triangle_t* triangle,
+                              vx_triangle_setup_t* setup, vx_vec3_t p) {
+    float a1 = vx__edge_area(&setup->e1, &triangle->p1, p);
+    float a2 = vx__edge_area(&setup->e2, &triangle->p2, p);
+    float a3 = vx__edge_area(&setup->e3, &triangle->p3, p);
+    float area = a1 + a2 + a3;
+
+    vx_color_t c1 = triangle->colors[0];
+    vx_color_t c2 = triangle->colors[1];
+    vx_color_t c3 = triangle->colors[2];
+
+    vx__vec3_multiply(&c1, a2 / area);
+    vx__vec3_multiply(&c2, a3 / area);
+    vx__vec3_multiply(&c3, a1 / area);
+
+    vx__vec3_add(&c1, &c2);
+    vx__vec3_add(&c1, &c3);
+
+    return c1;
+}
+
 void vx__aabb_init(vx_aabb_t* aabb) {
     aabb->max.x = aabb->max.y = aabb->max.z = -INFINITY;
     aabb->min.x = aabb->min.y = aabb->min.z = INFINITY;
@@ -706,33 +828,89 @@ void vx__add_voxel(vx_mesh_t* mesh, vx_vertex_t* pos, vx_color_t color,
     mesh->nvertices += 8;
 }
 
-vx_hash_table_t* vx__voxelize(vx_mesh_t const* m, vx_vertex_t vs,
+// Doubles the buckets of a table holding vx_voxel_data_t, so chains stay
+// short however many voxels it holds
+void vx__voxel_table_grow(vx_hash_table_t* table) {
+    size_t size = table->size * 2;
+    vx_hash_table_node_t** elements = VX_CALLOC(vx_hash_table_node_t*, size);
+
+    for (size_t i = 0; i < table->size; ++i) {
+        vx_hash_table_node_t* node = table->elements[i];
+
+        while (node) {
+            vx_hash_table_node_t* next = node->next;
+            vx_voxel_data_t* voxeldata = (vx_voxel_data_t*)node->data;
+            size_t hash = vx__vertex_hash(voxeldata->position, size);
+
+            node->prev = NULL;
+            node->next = elements[hash];
+            if (elements[hash]) {
+                elements[hash]->prev = node;
+            }
+            elements[hash] = node;
+
+            node = next;
+        }
+    }
+
+    VX_FREE(table->elements);
+    table->elements = elements;
+    table->size = size;
+}
+
+vx_mesh_view_t vx_mesh_view(vx_mesh_t const* mesh) {
+    vx_mesh_view_t view;
+    view.vertices = (const float*)mesh->vertices;
+    view.vertexstride = sizeof(vx_vertex_t);
+    view.colors = (const float*)mesh->colors;
+    view.colorstride = sizeof(vx_color_t);
+    view.indices = mesh->indices;
+    view.indexstride = sizeof(unsigned int);
+    view.nindices = mesh->nindices;
+    view.nvertices = mesh->nvertices;
+    return view;
+}
+
+// Reads 3 floats at element i of a strided buffer
+vx_vec3_t vx__view_vec3(const float* base, size_t stride, size_t i) {
+    const float* p = (const float*)((const char*)base +
+                                    i * (stride ? stride : 3 * sizeof(float)));
+    vx_vec3_t v = {{{p[0], p[1], p[2]}}};
+    return v;
+}
+
+unsigned int vx__view_index(vx_mesh_view_t const* view, size_t i) {
+    size_t stride = view->indexstride ? view->indexstride : sizeof(unsigned int);
+    return *(const unsigned int*)((const char*)view->indices + i * stride);
+}
+
+vx_hash_table_t* vx__voxelize(vx_mesh_view_t const* m, vx_vertex_t vs,
                               vx_vertex_t hvs, float precision,
                               size_t* nvoxels) {
     vx_hash_table_t* table = NULL;
 
     table = vx__hash_table_alloc(VOXELIZER_HASH_TABLE_SIZE);
 
-    for (size_t i = 0; i < m->nindices; i += 3) {
+    for (size_t i = 0; i + 2 < m->nindices; i += 3) {
         vx_triangle_t triangle;
         unsigned int i1, i2, i3;
 
-        VX_ASSERT(m->indices[i + 0] < m->nvertices);
-        VX_ASSERT(m->indices[i + 1] < m->nvertices);
-        VX_ASSERT(m->indices[i + 2] < m->nvertices);
+        i1 = vx__view_index(m, i + 0);
+        i2 = vx__view_index(m, i + 1);
+        i3 = vx__view_index(m, i + 2);
 
-        i1 = m->indices[i + 0];
-        i2 = m->indices[i + 1];
-        i3 = m->indices[i + 2];
+        VX_ASSERT(i1 < m->nvertices);
+        VX_ASSERT(i2 < m->nvertices);
+        VX_ASSERT(i3 < m->nvertices);
 
-        triangle.p1 = m->vertices[i1];
-        triangle.p2 = m->vertices[i2];
-        triangle.p3 = m->vertices[i3];
+        triangle.p1 = vx__view_vec3(m->vertices, m->vertexstride, i1);
+        triangle.p2 = vx__view_vec3(m->vertices, m->vertexstride, i2);
+        triangle.p3 = vx__view_vec3(m->vertices, m->vertexstride, i3);
 
         if (m->colors) {
-            triangle.colors[0] = m->colors[i1];
-            triangle.colors[1] = m->colors[i2];
-            triangle.colors[2] = m->colors[i3];
+            triangle.colors[0] = vx__view_vec3(m->colors, m->colorstride, i1);
+            triangle.colors[1] = vx__view_vec3(m->colors, m->colorstride, i2);
+            triangle.colors[2] = vx__view_vec3(m->colors, m->colorstride, i3);
         }
 
         if (vx__triangle_area(&triangle) < VOXELIZER_EPSILON) {
@@ -740,6 +918,9 @@ vx_hash_table_t* vx__voxelize(vx_mesh_t const* m, vx_vertex_t vs,
             continue;
         }
 
+        vx_triangle_setup_t setup;
+        vx__triangle_setup(&triangle, &setup);
+
         vx_aabb_t aabb = vx__triangle_aabb(&triangle);
 
         aabb.min.x = vx__map_to_voxel(aabb.min.x, vs.x, true);
@@ -773,65 +954,31 @@ vx_hash_table_t* vx__voxelize(vx_mesh_t const* m, vx_vertex_t vs,
 
                     if (vx__triangle_box_overlap(boxcenter, halfsize,
                                                  triangle)) {
-                        vx_vec3_t v1, v2, v3;
-                        vx_color_t c1, c2, c3;
                         vx_voxel_data_t* nodedata;
-                        float a1, a2, a3;
-                        float area;
 
                         nodedata = VX_MALLOC(vx_voxel_data_t, 1);
 
-                        v1 = triangle.p1;
-                        v2 = triangle.p2;
-                        v3 = triangle.p3;
-
-                        vx_vec3_t p1 = v1;
-                        vx__vec3_sub(&p1, &v3);
-                        vx_vec3_t p2 = v2;
-                        vx__vec3_sub(&p2, &v3);
-                        vx_vec3_t n = vx__vec3_cross(&p1, &p2);
-                        vx__vec3_normalize(&n);
-                        nodedata->normal = n;
+                        nodedata->normal = setup.normal;
                         if (m->colors != NULL) {
                             // Perform barycentric interpolation of colors
-
-                            c1 = triangle.colors[0];
-                            c2 = triangle.colors[1];
-                            c3 = triangle.colors[2];
-
-                            vx_triangle_t t1 = {{{v1, v2, boxcenter}},
-                                                {{{{0.0f, 0.0f, 0.0f}}}}};
-                            vx_triangle_t t2 = {{{v2, v3, boxcenter}},
-                                                {{{{0.0f, 0.0f, 0.0f}}}}};
-                            vx_triangle_t t3 = {{{v3, v1, boxcenter}},
-                                                {{{{0.0f, 0.0f, 0.0f}}}}};
-
-                            a1 = vx__triangle_area(&t1);
-                            a2 = vx__triangle_area(&t2);
-                            a3 = vx__triangle_area(&t3);
-
-                            area = a1 + a2 + a3;
-
-                            vx__vec3_multiply(&c1, a2 / area);
-                            vx__vec3_multiply(&c2, a3 / area);
-                            vx__vec3_multiply(&c3, a1 / area);
-
-                            vx__vec3_add(&c1, &c2);
-                            vx__vec3_add(&c1, &c3);
-
-                            nodedata->color = c1;
+                            nodedata->color = vx__triangle_color(
+                                &triangle, &setup, boxcenter);
                         }
 
                         nodedata->position = boxcenter;
 
-                        size_t hash = vx__vertex_hash(
-                            boxcenter, VOXELIZER_HASH_TABLE_SIZE);
+                        size_t hash = vx__vertex_hash(boxcenter, table->size);
 
                         bool insert = vx__hash_table_insert(
                             table, hash, nodedata, vx__vertex_comp_func);
 
                         if (insert) {
                             (*nvoxels)++;
+                            if (*nvoxels > table->size) {
+                                vx__voxel_table_grow(table);
+                            }
+                        } else {
+                            VX_FREE(nodedata);
                         }
                     }
                 }
@@ -853,7 +1000,8 @@ vx_mesh_t* vx_voxelize(vx_mesh_t const* m, float voxelsizex, float voxelsizey,
 
     vx__vec3_multiply(&hvs, 0.5f);
 
-    table = vx__voxelize(m, vs, hvs, precision, &voxels);
+    vx_mesh_view_t view = vx_mesh_view(m);
+    table = vx__voxelize(&view, vs, hvs, precision, &voxels);
 
     outmesh = VX_MALLOC(vx_mesh_t, 1);
     size_t nvertices = voxels * 8;
@@ -898,6 +1046,14 @@ vx_mesh_t* vx_voxelize(vx_mesh_t const* m, float voxelsizex, float voxelsizey,
 vx_point_cloud_t* vx_voxelize_pc(vx_mesh_t const* mesh, float voxelsizex,
                                  float voxelsizey, float voxelsizez,
                                  float precision) {
+    vx_mesh_view_t view = vx_mesh_view(mesh);
+    return vx_voxelize_pc_view(&view, voxelsizex, voxelsizey, voxelsizez,
+                               precision);
+}
+
+vx_point_cloud_t* vx_voxelize_pc_view(vx_mesh_view_t const* mesh,
+                                      float voxelsizex, float voxelsizey,
+                                      float voxelsizez, float precision) {
     vx_point_cloud_t* pc = NULL;
     vx_hash_table_t* table = NULL;
     size_t voxels = 0;
@@ -969,11 +1125,12 @@ unsigned int vx__mix(unsigned int abgr88880, unsigned int abgr88881) {
     return vx__rgbaf32_to_abgr8888(out);
 }
 
-unsigned int* vx_voxelize_snap_3dgrid(vx_mesh_t const* m, unsigned int width,
-                                      unsigned int height, unsigned int depth) {
-    vx_aabb_t* aabb = NULL;
+// Voxelizes m at the resolution of a width x height x depth grid spanning its
+// bounding box, aabb receives the bounds of the voxel centers
+vx_point_cloud_t* vx__snap_3dgrid_pc(vx_mesh_t const* m, unsigned int width,
+                                     unsigned int height, unsigned int depth,
+                                     vx_aabb_t* aabb) {
     vx_aabb_t* meshaabb = NULL;
-    float ax, ay, az;
 
     VX_ASSERT(m->colors);
 
@@ -1008,8 +1165,6 @@ unsigned int* vx_voxelize_snap_3dgrid(vx_mesh_t const* m, unsigned int width,
 
     vx_point_cloud_t* pc = vx_voxelize_pc(m, resx, resy, resz, 0.0);
 
-    aabb = VX_MALLOC(vx_aabb_t, 1);
-
     vx__aabb_init(aabb);
 
     for (size_t i = 0; i < pc->nvertices; i++) {
@@ -1019,41 +1174,71 @@ unsigned int* vx_voxelize_snap_3dgrid(vx_mesh_t const* m, unsigned int width,
         }
     }
 
+    VX_FREE(meshaabb);
+
+    return pc;
+}
+
+// Snaps the voxel center v of a point cloud made by vx__snap_3dgrid_pc to its
+// grid cell
+void vx__snap_3dgrid_cell(vx_vertex_t v, vx_aabb_t const* aabb,
+                          unsigned int width, unsigned int height,
+                          unsigned int depth, unsigned int cell[3]) {
+    float ax, ay, az;
+    float ox, oy, oz;
+    int ix, iy, iz;
+
     ax = aabb->max.x - aabb->min.x;
     ay = aabb->max.y - aabb->min.y;
     az = aabb->max.z - aabb->min.z;
 
-    unsigned int* data = VX_CALLOC(unsigned int, width* height* depth);
+    ox = v.x + fabs(aabb->min.x);
+    oy = v.y + fabs(aabb->min.y);
+    oz = v.z + fabs(aabb->min.z);
 
-    for (size_t i = 0; i < pc->nvertices; ++i) {
-        float rgba[4] = {pc->colors[i].r, pc->colors[i].g, pc->colors[i].b,
-                         1.0};
-        unsigned int color;
-        float ox, oy, oz;
-        int ix, iy, iz;
-        unsigned int index;
+    VX_ASSERT(ox >= 0.f);
+    VX_ASSERT(oy >= 0.f);
+    VX_ASSERT(oz >= 0.f);
+
+    ix = (ax == 0.0) ? 0 : (ox / ax) * (width - 1);
+    iy = (ay == 0.0) ? 0 : (oy / ay) * (height - 1);
+    iz = (az == 0.0) ? 0 : (oz / az) * (depth - 1);
 
-        ox = pc->vertices[i].x + fabs(aabb->min.x);
-        oy = pc->vertices[i].y + fabs(aabb->min.y);
-        oz = pc->vertices[i].z + fabs(aabb->min.z);
+    VX_ASSERT(ix >= 0);
+    VX_ASSERT(iy >= 0);
+    VX_ASSERT(iz >= 0);
 
-        VX_ASSERT(ox >= 0.f);
-        VX_ASSERT(oy >= 0.f);
-        VX_ASSERT(oz >= 0.f);
+    VX_ASSERT(ix + iy * width + iz * (width * height) <
+              width * height * depth);
+
+    cell[0] = ix;
+    cell[1] = iy;
+    cell[2] = iz;
+}
+
+unsigned int vx__snap_3dgrid_color(vx_point_cloud_t const* pc, size_t i) {
+    float rgba[4] = {pc->colors[i].r, pc->colors[i].g, pc->colors[i].b, 1.0};
+
+    return vx__rgbaf32_to_abgr8888(rgba);
+}
+
+unsigned int* vx_voxelize_snap_3dgrid(vx_mesh_t const* m, unsigned int width,
+                                      unsigned int height, unsigned int depth) {
+    vx_aabb_t aabb;
+    vx_point_cloud_t* pc = vx__snap_3dgrid_pc(m, width, height, depth, &aabb);
 
-        ix = (ax == 0.0) ? 0 : (ox / ax) * (width - 1);
-        iy = (ay == 0.0) ? 0 : (oy / ay) * (height - 1);
-        iz = (az == 0.0) ? 0 : (oz / az) * (depth - 1);
+    unsigned int* data = VX_CALLOC(unsigned int, width* height* depth);
 
-        VX_ASSERT(ix >= 0);
-        VX_ASSERT(iy >= 0);
-        VX_ASSERT(iz >= 0);
+    for (size_t i = 0; i < pc->nvertices; ++i) {
+        unsigned int color;
+        unsigned int cell[3];
+        unsigned int index;
 
-        VX_ASSERT(ix + iy * width + iz * (width * height) <
-                  width * height * depth);
+        vx__snap_3dgrid_cell(pc->vertices[i], &aabb, width, height, depth,
+                             cell);
 
-        color = vx__rgbaf32_to_abgr8888(rgba);
-        index = ix + iy * width + iz * (width * height);
+        color = vx__snap_3dgrid_color(pc, i);
+        index = cell[0] + cell[1] * width + cell[2] * (width * height);
 
         if (data[index] != 0) {
             data[index] = vx__mix(color, data[index]);
@@ -1062,13 +1247,77 @@ unsigned int* vx_voxelize_snap_3dgrid(vx_mesh_t const* m, unsigned int width,
         }
     }
 
-    VX_FREE(aabb);
-    VX_FREE(meshaabb);
     vx_point_cloud_free(pc);
 
     return data;
 }
 
+typedef struct vx_sparse_entry {
+    size_t index;  // Grid index of the voxel
+    size_t order;  // Position of the voxel in the point cloud
+    vx_sparse_voxel_t voxel;
+} vx_sparse_entry_t;
+
+int vx__sparse_entry_comp_func(const void* a, const void* b) {
+    const vx_sparse_entry_t* ea = (const vx_sparse_entry_t*)a;
+    const vx_sparse_entry_t* eb = (const vx_sparse_entry_t*)b;
+
+    if (ea->index != eb->index) {
+        return ea->index < eb->index ? -1 : 1;
+    }
+    return ea->order < eb->order ? -1 : (ea->order > eb->order);
+}
+
+vx_sparse_grid_t* vx_voxelize_snap_3dgrid_sparse(vx_mesh_t const* m,
+                                                 unsigned int width,
+                                                 unsigned int height,
+                                                 unsigned int depth) {
+    vx_aabb_t aabb;
+    vx_point_cloud_t* pc = vx__snap_3dgrid_pc(m, width, height, depth, &aabb);
+    vx_sparse_entry_t* entries = VX_MALLOC(vx_sparse_entry_t, pc->nvertices);
+
+    for (size_t i = 0; i < pc->nvertices; ++i) {
+        unsigned int cell[3];
+
+        vx__snap_3dgrid_cell(pc->vertices[i], &aabb, width, height, depth,
+                             cell);
+
+        entries[i].index = cell[0] + cell[1] * (size_t)width +
+                           cell[2] * ((size_t)width * height);
+        entries[i].order = i;
+        entries[i].voxel.x = cell[0];
+        entries[i].voxel.y = cell[1];
+        entries[i].voxel.z = cell[2];
+        entries[i].voxel.color = vx__snap_3dgrid_color(pc, i);
+    }
+
+    // Voxels sharing a cell are mixed in point cloud order, like the dense
+    // grid does
+    qsort(entries, pc->nvertices, sizeof(vx_sparse_entry_t),
+          vx__sparse_entry_comp_func);
+
+    vx_sparse_grid_t* grid = VX_MALLOC(vx_sparse_grid_t, 1);
+    grid->voxels = VX_MALLOC(vx_sparse_voxel_t, pc->nvertices);
+    grid->nvoxels = 0;
+    grid->width = width;
+    grid->height = height;
+    grid->depth = depth;
+
+    for (size_t i = 0; i < pc->nvertices; ++i) {
+        if (i > 0 && entries[i].index == entries[i - 1].index) {
+            vx_sparse_voxel_t* last = &grid->voxels[grid->nvoxels - 1];
+            last->color = vx__mix(entries[i].voxel.color, last->color);
+        } else {
+            grid->voxels[grid->nvoxels++] = entries[i].voxel;
+        }
+    }
+
+    VX_FREE(entries);
+    vx_point_cloud_free(pc);
+
+    return grid;
+}
+
 #undef VOXELIZER_EPSILON
 #undef VOXELIZER_INDICES_SIZE
 #undef VOXELIZER_HASH_TABLE_SIZE